@@ -1,10 +1,22 @@
+#if defined(__x86_64__) && defined(__linux__)
+#define _DEFAULT_SOURCE // -std=c2x에서도 MAP_ANONYMOUS를 쓰기 위해
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
 #include <stddef.h> // offsetof(relative memory adress in struct)
 #include <time.h>
-#include <setjmp.h> // try-catch
+#include <stdint.h>
+#include <assert.h> // static_assert
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h> // 스택 한도 (getrlimit)
+#endif
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h> // JIT 코드를 담을 실행 가능한 페이지
+#include <unistd.h>
+#define JIT_SUPPORTED
+#endif
 
 // Token
 #define N_RESERVED_WORD 16
@@ -14,10 +26,20 @@
 // Dynamic Array
 #define INITIAL_LIST_SIZE 2
 // Hash table
-#define TABLE_SIZE 100 
-#define KEY_SIZE 50
-
-jmp_buf jump_buffer;
+#define HASH_INLINE_CAPACITY 8 // 2의 거듭제곱
+// Memoization
+#define MEMO_DEFAULT_CAPACITY 4096
+// 실패가 이만큼 쌓일 때마다 적중률을 보고 MEMO_MIN_HIT_PERCENT보다 낮으면 메모를 끈다
+#define MEMO_PROBE_MISSES 1024
+#define MEMO_MIN_HIT_PERCENT 10
+// Frame stack
+#define FRAME_CHUNK_SIZE 256
+// 트리 워커의 호출 깊이 제한, --max-depth로 바꾼다
+#define MAX_CALL_DEPTH_DEFAULT 10000
+// 스택 한도를 알 수 없을 때 가정하는 크기와, 호출 검사 사이에 쓰일 몫과 에러 보고를 위해 남겨 두는 여유
+#define STACK_SIZE_FALLBACK (8 * 1024 * 1024)
+#define STACK_GUARD_RESERVE (256 * 1024)
+#define MAX_CALL_ARGUMENTS 255
 
 
 typedef enum TokenType {
@@ -40,7 +62,10 @@ typedef enum TokenType {
     
     END_OF_FILE,
     
-    INVALID_TOKEN
+    INVALID_TOKEN,
+
+    // 토큰이 아닌 런타임 전용 객체 타입
+    ROPE
 } TokenType;
 
 const char *TokenTypeStrs[] = {
@@ -67,6 +92,7 @@ typedef struct Token {
     TokenType type;
     char *lexeme;
     char *literal;
+    struct Object *name; // IDENTIFIER의 인턴된 이름 (환경 키)
     int line;
     struct Token *prev;
     struct Token *next;
@@ -100,41 +126,183 @@ TokenType getReservedToken(const char *c);
 
 // Token - end
 
+// Heap - start
+
+// 모든 malloc 계열 할당은 여기를 거쳐 종류별로 살아 있는 바이트 수를 센다.
+// --max-heap 예산을 넘는 할당은 스왑을 일으키기 전에 런타임 에러(70)로 끝낸다.
+typedef enum HeapCategory {
+    HEAP_VALUES, HEAP_STRINGS, HEAP_ENVIRONMENTS, HEAP_AST, HEAP_TOKENS, HEAP_RUNTIME, HEAP_BYTECODE,
+    HEAP_CATEGORY_COUNT
+} HeapCategory;
+
+const char* HeapCategoryStrs[] = {"values", "strings", "environments", "ast", "tokens", "runtime", "bytecode"};
+
+// 해제할 때 크기와 종류를 알 수 있도록 블록 앞에 붙인다
+typedef union HeapHeader {
+    struct {
+        size_t size;
+        HeapCategory category;
+    } info;
+    max_align_t align;
+} HeapHeader;
+
+typedef struct Heap {
+    size_t live[HEAP_CATEGORY_COUNT];
+    size_t peak[HEAP_CATEGORY_COUNT];
+    size_t total;
+    size_t peak_total;
+    size_t limit;      // 0이면 제한 없음
+    size_t collect_at; // 제한이 있을 때, 총량이 이보다 커지면 다음 안전 지점에서 수집한다
+} Heap;
+
+Heap heap = {0};
+int heap_stats_flag = 0;
+
+void heapGrow(HeapCategory category, size_t size);
+void heapShrink(HeapCategory category, size_t size);
+void* heapAllocate(size_t size, HeapCategory category);
+void* heapCallocate(size_t count, size_t size, HeapCategory category);
+void* heapReallocate(void* pointer, size_t size, HeapCategory category);
+char* heapStrdup(const char* string, HeapCategory category);
+void heapFree(void* pointer);
+void heapLimitExceeded(size_t size);
+void printHeapStats();
+
+// Heap - end
+
 // Object - start
 
 typedef struct Object{
     TokenType type;
     void* value;
+    unsigned int mark_epoch; // 이번 수집에서 도달했으면 gc.epoch
+    struct Object* next;     // 수집 대상 객체 목록
 } Object;
 
+// 길이, 해시, 바이트를 Object 헤더 바로 뒤에 한 번에 할당한다
 typedef struct {
-    double number;
-} NumberValue;
-
-typedef struct {
-    int boolean; // 1 (true) or 0 (false)
-} BoolValue;
-
-typedef struct {
-    char* string;
+    size_t length;
+    unsigned int hash;
+    char string[];
 } StringValue;
 
 Object* createObject(TokenType type, void* value);
 
+// 숫자는 double 그대로, 나머지는 quiet NaN 영역에 태그/포인터를 넣는다
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+#define TAG_UNDEFINED 4 // 아직 정의되지 않은 전역 슬롯, 언어에서는 보이지 않는다
+
+#define NIL_VAL ((Value)(QNAN | TAG_NIL))
+#define FALSE_VAL ((Value)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(QNAN | TAG_TRUE))
+#define UNDEFINED_VAL ((Value)(QNAN | TAG_UNDEFINED))
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+#define NUMBER_VAL(num) numberToValue(num)
+#define OBJ_VAL(obj) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+#define IS_NIL(v) ((v) == NIL_VAL)
+#define IS_BOOL(v) (((v) | 1) == TRUE_VAL)
+#define IS_NUMBER(v) (((v) & QNAN) != QNAN)
+#define IS_OBJ(v) (((v) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_STRING(v) (IS_OBJ(v) && AS_OBJ(v)->type == STRING)
+#define IS_FUNCTION(v) (IS_OBJ(v) && AS_OBJ(v)->type == FUN)
+
+#define AS_BOOL(v) ((v) == TRUE_VAL)
+#define AS_NUMBER(v) valueToNumber(v)
+#define AS_OBJ(v) ((Object*)(uintptr_t)((v) & ~(SIGN_BIT | QNAN)))
+#define IS_ROPE(v) (IS_OBJ(v) && AS_OBJ(v)->type == ROPE)
+#define AS_STRING(v) ((StringValue*)AS_OBJ(v)->value)
+#define AS_CSTRING(v) (AS_STRING(v)->string)
+
+// 방문자는 void*를 돌려주므로 Value 비트를 그대로 실어 나른다
+static_assert(sizeof(void*) == sizeof(Value), "Value must fit in a pointer");
+#define VALUE_RESULT(v) ((void*)(uintptr_t)(v))
+#define RESULT_VALUE(result) ((Value)(uintptr_t)(result))
+
+static inline Value numberToValue(double number){
+    Value value;
+    memcpy(&value, &number, sizeof(double));
+    return value;
+}
+
+static inline double valueToNumber(Value value){
+    double number;
+    memcpy(&number, &value, sizeof(Value));
+    return number;
+}
+
 // Object - end
 
+// String intern - start
+
+// 같은 내용의 문자열은 하나의 Object만 존재하므로 비교는 포인터 비교로 충분하다.
+// 테이블은 문자열을 붙잡지 않는다(weak): 회수되는 문자열은 테이블에서도 지워야 한다.
+typedef struct InternTable {
+    Object** slots;
+    size_t capacity;
+    size_t count; // 툼스톤 포함
+} InternTable;
+
+#define INTERN_TOMBSTONE ((Object*)1)
+
+InternTable intern_table = {NULL, 0, 0};
+
+unsigned int hashString(const char* chars, size_t length);
+Object* internString(const char* chars, size_t length);
+void growInternTable();
+
+// String intern - end
+
+// Rope - start
+
+// 긴 문자열의 + 는 복사하지 않고 트리로 이어 붙인 뒤, 내용이 필요할 때 한 번만 펼친다
+#define ROPE_MIN_LENGTH 64
+
+typedef struct RopeValue {
+    size_t length;
+    Object* left;  // STRING 또는 ROPE
+    Object* right;
+    Object* flat;  // 펼친 결과 (인턴된 STRING), 아직 없으면 NULL
+} RopeValue;
+
+Object* createRope(Object* left, Object* right);
+size_t stringLength(Object* object);
+Object* flattenRope(Object* rope);
+Value flattenValue(Value value);
+
+// Rope - end
+
 
 // Hash map - start
+
+// 스코프 대부분은 이름이 몇 개뿐이므로 인라인 배열로 시작하고, 부하율이 3/4를 넘으면 두 배로 키운다.
+// 키는 인턴된 문자열이라 포인터 비교로 찾고, 환경에서 이름을 지우는 일은 없으므로 툼스톤도 없다.
 typedef struct Entry {
-    char key[KEY_SIZE];
-    Object* value;
-    struct Entry* next; // 충돌 처리를 위한 체이닝
+    Object* key; // 인턴된 문자열, NULL이면 빈 칸
+    unsigned int hash; // 키의 해시, 테이블을 키울 때 키를 다시 따라가지 않는다
+    Value value;
 } Entry;
 
-unsigned int hash(char* key);
-void insert(Entry* hashTable[], char* key, Object* value);
-Object* find(Entry* hashTable[], char* key);
-void releaseHashTable(Entry* hashTable[]);
+typedef struct HashTable {
+    Entry* entries; // inline_entries 또는 힙에 할당된 배열
+    unsigned int capacity;
+    unsigned int count;
+    Entry inline_entries[HASH_INLINE_CAPACITY];
+} HashTable;
+
+void initHashTable(HashTable* table);
+Entry* findEntry(HashTable* table, Object* key);
+void insert(HashTable* table, Object* key, Value value);
+int find(HashTable* table, Object* key, Value* value);
+void growHashTable(HashTable* table);
+void releaseHashTable(HashTable* table);
 // Hash map - end
 
 // Expression - start
@@ -154,6 +322,29 @@ typedef struct Visitor {
     void *(*visitAssignExpr)(struct Visitor *self, Expr *expr);
     void *(*visitLogicalExpr)(struct Visitor *self, Expr *expr);    
     void *(*visitCallExpr)(struct Visitor *self, Expr *expr);    
+    void *(*visitCseDefExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitCseUseExpr)(struct Visitor *self, Expr *expr);
+    // 타입 추론으로 피연산자가 항상 숫자임이 증명된 노드 (타입 검사 없음)
+    void *(*visitNumberAddExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberSubtractExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberMultiplyExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberDivideExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberGreaterExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberGreaterEqualExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberLessExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberLessEqualExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberEqualExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberNotEqualExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitNumberNegateExpr)(struct Visitor *self, Expr *expr);
+    // 실행 중 숫자만 관찰한 노드가 스스로 바뀌는 형태, 가드가 실패하면 일반 노드로 되돌아간다
+    void *(*visitGuardedNumberAddExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitGuardedNumberSubtractExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitGuardedNumberMultiplyExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitGuardedNumberDivideExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitGuardedNumberGreaterExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitGuardedNumberGreaterEqualExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitGuardedNumberLessExpr)(struct Visitor *self, Expr *expr);
+    void *(*visitGuardedNumberLessEqualExpr)(struct Visitor *self, Expr *expr);
 } Visitor;
 
 typedef struct ExprBinary
@@ -182,18 +373,23 @@ typedef struct ExprLiteral
     Expr base;
     TokenType type;
     char *value;
+    Value constant; // 파싱할 때 한 번만 변환해 둔 값
 } ExprLiteral;
 
 typedef struct Variable
 {
     Expr base;
     Token* name;
+    int slot;       // 함수 인자를 가리키면 프레임 슬롯 번호, 아니면 -1이고 이름으로 찾는다
+    int global_slot; // 전역을 가리키면 전역 테이블 슬롯 번호, 아니면 -1
 } Variable;
 
 typedef struct Assign {
     Expr base;
     Token* name;
     Expr* value;
+    int slot;
+    int global_slot;
 } Assign;
 
 typedef struct Logical {
@@ -205,13 +401,35 @@ typedef struct Logical {
 
 typedef struct Array Array;
 
+struct Function;
+
 typedef struct Call {
     Expr base;
     Expr* callee;
     Token* paren;
     Array* arguments;
+    // 단형 인라인 캐시: 마지막으로 부른 함수를 기억해 두고 같은 함수면 찾기와 검사를 건너뛴다
+    int global_callee;              // 호출 대상이 전역 이름으로 정해졌다 (리졸버가 채운다)
+    unsigned int cache_version;     // 전역 호출 대상을 찾았을 때의 globals_version
+    Value cached_callee;
+    struct Function* cached_declaration;
+    int cache_misses;
 } Call;
 
+// Common subexpression elimination: the first evaluation stores into a temporary slot,
+// later occurrences read the slot back instead of re-evaluating the subtree.
+typedef struct CseDef {
+    Expr base;
+    Expr* expression;
+    int slot;
+} CseDef;
+
+typedef struct CseUse {
+    Expr base;
+    CseDef* def;
+    int slot;
+} CseUse;
+
 
 void* ExprBinaryAccept(Expr *self, Visitor *visitor);
 void* ExprUnaryAccept(Expr *self, Visitor *visitor);
@@ -221,6 +439,27 @@ void* ExprVariableAccept(Expr *self, Visitor *visitor);
 void* ExprAssignAccept(Expr *self, Visitor *visitor);
 void* ExprLogicalAccept(Expr *self, Visitor *visitor);
 void* ExprCallAccept(Expr* self, Visitor *visitor);
+void* ExprCseDefAccept(Expr* self, Visitor *visitor);
+void* ExprCseUseAccept(Expr* self, Visitor *visitor);
+void* ExprNumberAddAccept(Expr* self, Visitor *visitor);
+void* ExprNumberSubtractAccept(Expr* self, Visitor *visitor);
+void* ExprNumberMultiplyAccept(Expr* self, Visitor *visitor);
+void* ExprNumberDivideAccept(Expr* self, Visitor *visitor);
+void* ExprNumberGreaterAccept(Expr* self, Visitor *visitor);
+void* ExprNumberGreaterEqualAccept(Expr* self, Visitor *visitor);
+void* ExprNumberLessAccept(Expr* self, Visitor *visitor);
+void* ExprNumberLessEqualAccept(Expr* self, Visitor *visitor);
+void* ExprNumberEqualAccept(Expr* self, Visitor *visitor);
+void* ExprNumberNotEqualAccept(Expr* self, Visitor *visitor);
+void* ExprNumberNegateAccept(Expr* self, Visitor *visitor);
+void* ExprGuardedNumberAddAccept(Expr* self, Visitor *visitor);
+void* ExprGuardedNumberSubtractAccept(Expr* self, Visitor *visitor);
+void* ExprGuardedNumberMultiplyAccept(Expr* self, Visitor *visitor);
+void* ExprGuardedNumberDivideAccept(Expr* self, Visitor *visitor);
+void* ExprGuardedNumberGreaterAccept(Expr* self, Visitor *visitor);
+void* ExprGuardedNumberGreaterEqualAccept(Expr* self, Visitor *visitor);
+void* ExprGuardedNumberLessAccept(Expr* self, Visitor *visitor);
+void* ExprGuardedNumberLessEqualAccept(Expr* self, Visitor *visitor);
 
 typedef struct AstPrinter{
     Visitor base;
@@ -281,13 +520,26 @@ typedef struct Array Array;
 typedef struct Block {
     Stmt base;
     Array* statements;
+    int escapes;    // 0이면 환경을 프레임 스택에 할당하고 블록을 나갈 때 회수한다
+    int declares;   // 0이면 새 스코프가 필요 없으므로 바깥 환경을 그대로 쓴다
 } Block;
 
+typedef struct MemoTable MemoTable;
+
 typedef struct Function {
     Stmt base;
     Token* name;
     Array* params;
     Array* body;
+    MemoTable* memo;    // 순수 함수로 판정된 경우에만 생성된다
+    struct Chunk* chunk; // --vm에서 컴파일한 바이트코드
+    struct ClosureCode* closure_code; // --closures에서 컴파일한 클로저
+    struct JitCode* jit_code; // 호출과 반복 횟수가 문턱을 넘으면 만든 기계어
+    int jit_hotness;
+    int jit_rejected;   // JIT가 다룰 수 없는 문장이나 식이 있다
+    int escapes;        // 호출마다 만드는 환경이 활성 구간 밖으로 빠져나갈 수 있는지
+    int param_slots;    // 인자를 환경 대신 프레임 슬롯으로 읽는다 (본문 최상위에서 인자 이름을 다시 선언하면 0)
+    int body_declares;  // 본문 최상위에 var나 fun 선언이 있는지
 } Function;
 
 typedef struct Return {
@@ -296,7 +548,7 @@ typedef struct Return {
     Expr* value;
 } Return;
 
-Object* global_return_value = NULL;
+Value global_return_value;
 
 typedef struct StmtVisitor{
     void* (*visitExpressionStmt)(struct StmtVisitor* self, Stmt* stmt);
@@ -343,7 +595,7 @@ void* InterpreterVisitReturnStmt(StmtVisitor* self, Stmt* stmt);
 
 typedef enum {
     TOKEN,
-    OBJECT,
+    VALUE,
     PRINT_STMT,
     EXPRESSION_STMT,
     VAR_STMT,
@@ -358,7 +610,7 @@ typedef struct Element {
     ElementType type;
     union {
         Token* token;
-        Object* object;
+        Value value;
         Print* print_stmt;
         Expression* expr_stmt;
         Var* var_stmt;
@@ -381,6 +633,7 @@ Array* createArray(size_t initialCapacity);
 void addElement(Array* array, Element element); 
 void* getElement(Array* array, size_t index);
 void releaseArray(Array* array);
+Stmt* elementStmt(Element* element);
 
 // Parser - start
 
@@ -459,19 +712,70 @@ Parser* createParser();
 
 // Environment - start
 typedef struct Environment{
-    Entry* values[TABLE_SIZE];
-    void* (*define)(struct Environment* self, char* name, Object* value);
-    Object* (*get)(struct Environment* self, Token* name);
-    void* (*assign)(struct Environment* self, Token* name, Object* value);
+    HashTable values;
+    void* (*define)(struct Environment* self, Object* name, Value value);
+    Value (*get)(struct Environment* self, Token* name);
+    void* (*assign)(struct Environment* self, Token* name, Value value);
     struct Environment* enclosing;
+    unsigned int mark_epoch;
+    struct Environment* gc_next; // 힙에 할당된 환경만 수집 대상 목록에 들어간다
 } Environment;
 
 Environment* createEnvironment();
 Environment* createEnvironmentWithEnclosing(Environment* enclosing);
-
-void* define(Environment* self, char* name, Object* value);
-Object* get(Environment* self, Token* name);
-void* assign(Environment* self, Token* name, Object* value);
+void initEnvironment(Environment* env, Environment* enclosing);
+void releaseEnvironmentEntries(Environment* env);
+
+// 캡처되지 않는 환경은 LIFO 순서로만 생기고 사라지므로 청크 단위의 스택에 할당한다
+typedef struct FrameChunk {
+    Environment frames[FRAME_CHUNK_SIZE];
+    struct FrameChunk* prev;
+    struct FrameChunk* next;
+} FrameChunk;
+
+typedef struct FrameStack {
+    FrameChunk* chunk;
+    int top;
+} FrameStack;
+
+typedef struct FrameMark {
+    FrameChunk* chunk;
+    int top;
+} FrameMark;
+
+FrameStack* createFrameStack();
+Environment* pushFrameEnvironment(FrameStack* stack, Environment* enclosing);
+void popFrameEnvironment(FrameStack* stack);
+FrameMark markFrameStack(FrameStack* stack);
+void unwindFrameStack(FrameStack* stack, FrameMark mark);
+
+void* define(Environment* self, Object* name, Value value);
+Value get(Environment* self, Token* name);
+void* assign(Environment* self, Token* name, Value value);
+
+// Environment - end
+
+// Global table - start
+// 전역은 이름마다 한 번 정해지는 슬롯 번호로 조밀한 배열에 둔다. 전역 환경의 해시 테이블은 비어 있다
+typedef struct GlobalTable {
+    HashTable ids;      // 이름 -> 슬롯 번호
+    Value* values;      // 정의되기 전에는 UNDEFINED_VAL
+    Object** names;
+    int count;
+    int capacity;
+} GlobalTable;
+
+GlobalTable global_table;
+
+void initGlobalTable();
+int globalSlot(Object* name);
+void defineGlobal(int slot, Value value);
+Value getGlobal(int slot, Token* name);
+void setGlobal(int slot, Token* name, Value value);
+void undefinedVariable(Token* name);
+void markGlobalTable();
+
+// Global table - end
 
 Token *g_head_pointer;
 Token *g_tail_pointer;
@@ -488,21 +792,28 @@ typedef struct Interpreter {
     StmtVisitor stmt_visitor;
     Environment* environment;
     Environment* globals;
-    Object* (*evaluate)(struct Interpreter* self, Expr* expr);
+    FrameStack* frames;
+    Value* cse_slots;
+    int cse_slot_count;
+    int returning;  // return 문이 실행되어 함수 본문을 빠져나가는 중, 블록과 반복문은 이 값을 보고 멈춘다
+    Value* slots;   // 실행 중인 함수의 인자, 슬롯 스택 위에 있다
+    int call_depth;
+    int function_depth; // 실행 중인 Lox 함수 본문의 수, 0이면 최상위 코드라 꼬리 호출을 이어 받을 호출자가 없다
+    // return f(...)는 호출하지 않고 함수와 인자만 남긴 채 빠져나간다. 함수를 부른 쪽이 같은 C 스택 프레임에서 이어서 실행한다
+    int tail_calling;
+    Value tail_callee;
+    int tail_arg_count;
+    Value tail_arguments[MAX_CALL_ARGUMENTS];
+    Value (*evaluate)(struct Interpreter* self, Expr* expr);
     void (*execute)(struct Interpreter* self, Stmt* stmt);
     void (*interpret)(struct Interpreter* self, Array* array);
     void (*interpretExpr)(struct Interpreter* self, Expr* expr);
     void (*executeBlock)(struct Interpreter* self, Array* statements, Environment* environment);
 } Interpreter;
 
-typedef struct RuntimeError {
-    Token token;
-    char* message;
-} RuntimeError;
-
-RuntimeError* createRuntimeError(Token token, char* message);
-RuntimeError* checkNumberOperand(Token operator, Object operand);
-RuntimeError* checkNumberOperands(Token operator, Object left, Object right);
+void runtimeError(Token* token, char* message);
+void checkNumberOperand(Token* operator, Value operand);
+void checkNumberOperands(Token* operator, Value left, Value right);
 int runtime_error_flag = 0;
 
 void* InterpreterVisitLiteralExpr(Visitor* self, Expr* expr);
@@ -513,38 +824,104 @@ void* InterpreterVisitVariableExpr(Visitor* self, Expr* expr);
 void* InterpreterVisitAssignExpr(Visitor* self, Expr* expr);
 void* InterpreterVisitLogicalExpr(Visitor* self, Expr* expr);
 void* InterpreterVisitCallExpr(Visitor* self, Expr* expr);
-Object* evaluate(struct Interpreter* self, Expr* expr);
+void* InterpreterVisitCseDefExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitCseUseExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberAddExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberSubtractExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberMultiplyExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberDivideExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberGreaterExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberGreaterEqualExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberLessExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberLessEqualExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberEqualExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberNotEqualExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitNumberNegateExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitGuardedNumberAddExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitGuardedNumberSubtractExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitGuardedNumberMultiplyExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitGuardedNumberDivideExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitGuardedNumberGreaterExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitGuardedNumberGreaterEqualExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitGuardedNumberLessExpr(Visitor* self, Expr* expr);
+void* InterpreterVisitGuardedNumberLessEqualExpr(Visitor* self, Expr* expr);
+void quickenBinaryExpr(ExprBinary* expr_binary);
+int isGuardedNumberExpr(Expr* expr);
+
+// 숫자 이항 연산 목록. 정적으로 특수화한 노드와 실행 중 가드를 붙인 노드를 모두 여기서 만든다
+#define NUMBER_BINARY_OPERATIONS(X) \
+    X(Add, PLUS, numberPlusOperation(left, right)) \
+    X(Subtract, MINUS, minusOperation(left, right)) \
+    X(Multiply, STAR, multiplyOperation(left, right)) \
+    X(Divide, SLASH, quotientOperation(left, right)) \
+    X(Greater, GREATER, relationalOperation(left, right, isGreater)) \
+    X(GreaterEqual, GREATER_EQUAL, relationalOperation(left, right, isGreaterEqual)) \
+    X(Less, LESS, relationalOperation(left, right, isLess)) \
+    X(LessEqual, LESS_EQUAL, relationalOperation(left, right, isLessEqual))
+
+// 연산자 토큰과 그 연산을 맡는 노드의 accept
+typedef struct NumberOperator {
+    TokenType type;
+    void* (*accept)(Expr* self, Visitor* visitor);
+} NumberOperator;
+
+#define NUMBER_OPERATOR_ENTRY(name, type, operation) {type, ExprNumber##name##Accept},
+#define GUARDED_NUMBER_OPERATOR_ENTRY(name, type, operation) {type, ExprGuardedNumber##name##Accept},
+
+// 타입 추론이 양쪽을 숫자로 증명한 이항식이 바뀌어 들어갈 노드
+const NumberOperator number_operators[] = {
+    NUMBER_BINARY_OPERATIONS(NUMBER_OPERATOR_ENTRY)
+    {EQUAL_EQUAL, ExprNumberEqualAccept}, {BANG_EQUAL, ExprNumberNotEqualAccept},
+};
+#define NUMBER_OPERATOR_COUNT ((int)(sizeof(number_operators) / sizeof(number_operators[0])))
+
+// 실행 중 숫자만 관찰한 이항식이 바뀌어 들어갈 노드
+const NumberOperator guarded_number_operators[] = {
+    NUMBER_BINARY_OPERATIONS(GUARDED_NUMBER_OPERATOR_ENTRY)
+};
+#define GUARDED_NUMBER_OPERATOR_COUNT ((int)(sizeof(guarded_number_operators) / sizeof(guarded_number_operators[0])))
+
+#undef NUMBER_OPERATOR_ENTRY
+#undef GUARDED_NUMBER_OPERATOR_ENTRY
+
+const NumberOperator* findNumberOperator(const NumberOperator* operators, int count, TokenType type);
+int isNumberOperatorAccept(const NumberOperator* operators, int count, void* (*accept)(Expr*, Visitor*));
+Value binaryOperation(Interpreter* interpreter, ExprBinary* expr_binary, Value left, Value right);
+Value literalConstant(TokenType type, char* value);
+Value evaluate(struct Interpreter* self, Expr* expr);
 void execute(struct Interpreter* self, Stmt* stmt);
 void interpret(struct Interpreter* self, Array* statements);
 void interpretExpr(struct Interpreter* self, Expr* expr);
 void executeBlock(Interpreter* self, Array* statements, Environment* environment);
 
-char* stringify(Object object);
+char* stringify(Value value);
 
 int endsWith(char *c, size_t c_size, char *end, size_t end_size);
 
 Interpreter *createInterpreter();
 
-int isTruthy(Object* object);
-TokenType isEqual(Object* a, Object* b);
+int isTruthy(Value value);
+int isEqual(Value a, Value b);
 
-Object* quotientOperation(Object* left, Object* right);
-Object* multiplyOperation(Object* left, Object* right); 
-Object* plusOperation(Object* left, Object* right);
-Object* minusOperation(Object* left, Object* right);
+Value quotientOperation(Value left, Value right);
+Value multiplyOperation(Value left, Value right); 
+int plusOperation(Value left, Value right, Value* result);
+Value numberPlusOperation(Value left, Value right);
+Value numberEqualOperation(Value left, Value right, int negate);
+Value minusOperation(Value left, Value right);
 
 int isGreater(double left, double right);
 int isGreaterEqual(double left, double right);
 int isLess(double left, double right);
 int isLessEqual(double left, double right);
-Object* relationalOperation(Object* left, Object* right, int (*comparison)(double, double));
+Value relationalOperation(Value left, Value right, int (*comparison)(double, double));
 
 // Interpreter - end
 
 // LoxCallable - start
 
 typedef struct LoxCallable {
-    Object* (*call)(void* self, Interpreter* interpreter, Array* arguments);
+    Value (*call)(void* self, Interpreter* interpreter, Value* arguments, int arg_count);
     int (*arity)(struct LoxCallable* self);
 } LoxCallable;
 
@@ -555,10 +932,18 @@ typedef struct LoxFunction {
 } LoxFunction;
 
 LoxFunction* createNativeFunction(int (*arity)(LoxCallable* self),
-                                Object* (*function_call)(void* self, Interpreter* interpreter, Array* arguments),
+                                Value (*function_call)(void* self, Interpreter* interpreter, Value* arguments, int arg_count),
                                 char* (*to_string)(LoxFunction* self));
 LoxFunction* createLoxFunction(Function* declaration);
-Object* functionCall(void* self, Interpreter* interpreter, Array* arguments);
+Value functionCall(void* self, Interpreter* interpreter, Value* arguments, int arg_count);
+Value runFunctionBody(Interpreter* interpreter, Function* fun_decl, Value* arguments, int arg_count);
+Value memoizedCall(void* self, Interpreter* interpreter, Value* arguments, int arg_count);
+Value runTailCalls(Interpreter* interpreter, Value* arguments, int arg_count, int owned_slots);
+Value returnTailCall(Interpreter* interpreter, Call* call);
+int isTailCall(Expr* value);
+Value* pushCallArguments(Interpreter* interpreter, Array* arguments);
+LoxCallable* checkCallable(Value callee, Token* paren, int arg_count);
+Value* evaluateCall(Interpreter* interpreter, Call* expr_call, Value* callee_out, LoxCallable** callable_out);
 int arity(LoxCallable* self);
 char* toString(LoxFunction* self);
 // LoxCallable - end
@@ -566,28 +951,645 @@ char* toString(LoxFunction* self);
 // native function - start
 
 int nativeClockArity(LoxCallable* self);
-Object* nativeClockFunctionCall(void* self, Interpreter* interpreter, Array* arguments);
+Value nativeClockFunctionCall(void* self, Interpreter* interpreter, Value* arguments, int arg_count);
 char* nativeClockToString(LoxFunction* self);
 
 // native function - end
 
+// Slab allocator - start
+
+// 크기가 같은 구조체는 페이지 크기의 slab에서 잘라 쓰고, 해제되면 free list로 재사용한다.
+// slab은 SLAB_SIZE로 정렬되어 있어 주소만으로 자신이 속한 slab을 찾을 수 있다.
+#define SLAB_SIZE 4096
+#define SLAB_HEADER_SIZE 64
+
+typedef struct Slab {
+    struct Slab* next;
+    struct SlabPool* pool;
+    size_t live;
+} Slab;
+
+typedef struct SlabPool {
+    const char* name;
+    size_t object_size;
+    HeapCategory category;
+    Slab* slabs;
+    void* free_list;
+    size_t slab_count;
+    size_t live;
+} SlabPool;
+
+SlabPool environment_pool = {"Environment", sizeof(Environment), HEAP_ENVIRONMENTS, NULL, NULL, 0, 0};
+SlabPool function_object_pool = {"Object(FUN)", sizeof(Object), HEAP_VALUES, NULL, NULL, 0, 0};
+SlabPool lox_function_pool = {"LoxFunction", sizeof(LoxFunction), HEAP_VALUES, NULL, NULL, 0, 0};
+SlabPool rope_pool = {"Object(ROPE)", sizeof(Object) + sizeof(RopeValue), HEAP_VALUES, NULL, NULL, 0, 0};
+
+int slab_stats_flag = 0;
+
+void* slabAllocate(SlabPool* pool);
+void slabFree(void* pointer);
+size_t slabCapacity(SlabPool* pool);
+void printSlabStats();
+
+// Slab allocator - end
+
+// Optimizer - start
+
+int optimize_flag = 0;
+int memo_stats_flag = 0;
+int memo_capacity = MEMO_DEFAULT_CAPACITY;
+int max_call_depth = MAX_CALL_DEPTH_DEFAULT;
+
+// 호출 하나가 C 스택을 얼마나 쓰는지는 본문의 블록과 식이 얼마나 깊은지에 달려 있어서 깊이만으로는 막을 수 없다.
+// C 스택 위에서 재귀하는 엔진은 호출할 때마다 main에서 잰 바닥부터 실제로 쓴 양도 확인한다
+uintptr_t stack_base = 0;
+size_t stack_budget = 0;
+void initStackGuard(char* base);
+
+static inline int stackExhausted(){
+    char marker;
+    uintptr_t here = (uintptr_t)&marker;
+    size_t used = stack_base > here ? stack_base - here : here - stack_base;
+    return used > stack_budget;
+}
+
+// 전역 환경에 이름이 새로 정의되거나 함수가 들어 있던 전역이 바뀌면 올린다. 0은 캐시가 비었다는 뜻이다
+unsigned int globals_version = 1;
+
+typedef struct CallCacheStats {
+    long hits;
+    long misses;
+    long sites;             // 한 번이라도 실행된 호출 위치
+    long polymorphic_sites; // 두 번 이상 놓친 위치
+} CallCacheStats;
+
+CallCacheStats call_cache = {0, 0, 0, 0};
+int call_stats_flag = 0;
+void printCallStats();
+
+typedef struct CseEntry {
+    unsigned int hash;
+    Expr* expression;
+    Expr** site;    // 처음 평가되는 위치, 재사용될 때 CseDef로 감싼다
+    CseDef* def;
+    int killed;
+} CseEntry;
+
+typedef struct CseTable {
+    CseEntry* entries;
+    size_t count;
+    size_t capacity;
+    size_t floor;   // 함수 본문은 바깥 엔트리를 볼 수 없다
+    int slot_count;
+} CseTable;
+
+CseTable* createCseTable();
+void releaseCseTable(CseTable* table);
+int isCseCandidate(Expr* expr);
+int isPureExpr(Expr* expr);
+unsigned int cseHash(Expr* expr);
+int cseEqual(Expr* a, Expr* b);
+int cseMentions(Expr* expr, char* name);
+CseEntry* cseLookup(CseTable* table, unsigned int hash, Expr* expr);
+void cseRegister(CseTable* table, unsigned int hash, Expr** site);
+Expr* createCseUse(CseTable* table, CseEntry* entry);
+void cseKillAll(CseTable* table);
+void cseKillName(CseTable* table, char* name);
+void cseTruncate(CseTable* table, size_t mark);
+void cseExpr(CseTable* table, Expr** site);
+void cseStmt(CseTable* table, Stmt* stmt);
+void cseStatements(CseTable* table, Array* statements);
+int eliminateCommonSubexpressions(Array* statements);
+
+Expr* createFoldedLiteral(Value constant);
+int foldNumberOperation(TokenType type, Value left, Value right, Value* result);
+void foldExpr(Expr** site);
+void foldStmt(Stmt* stmt);
+void foldConstants(Array* statements);
+
+typedef enum InferredType {
+    INFERRED_NUMBER,
+    INFERRED_STRING,
+    INFERRED_BOOL,
+    INFERRED_NIL,
+    INFERRED_ANY
+} InferredType;
+
+typedef struct TypedVariable {
+    char* name;
+    int depth;
+    InferredType type;
+} TypedVariable;
+
+typedef struct TypeInference {
+    TypedVariable* variables;   // 선언 순서대로 쌓이는 스택, 블록을 나가면 잘라낸다
+    size_t count;
+    size_t capacity;
+    size_t function_floor;      // 함수 본문에서는 이 아래의 지역 변수가 보이지 않는다
+    int depth;
+    int in_function;
+    int dry_run;                // 루프 고정점을 계산하는 동안에는 노드를 바꾸지 않는다
+    int specialized_count;
+} TypeInference;
+
+int isBinaryExpr(Expr* expr);
+int isUnaryExpr(Expr* expr);
+InferredType joinInferredType(InferredType a, InferredType b);
+TypedVariable* resolveTypedVariable(TypeInference* inference, char* name);
+void declareTypedVariable(TypeInference* inference, char* name, InferredType type);
+InferredType* saveInferredTypes(TypeInference* inference);
+void restoreInferredTypes(TypeInference* inference, InferredType* types);
+void joinInferredTypes(TypeInference* inference, InferredType* other);
+void forgetGlobalTypes(TypeInference* inference);
+InferredType inferExpr(TypeInference* inference, Expr* expr);
+void inferStmt(TypeInference* inference, Stmt* stmt);
+void inferStatements(TypeInference* inference, Array* statements);
+int specializeNumericNodes(Array* statements);
+
+typedef struct MemoEntry {
+    Value* arguments;
+    Value result;
+    unsigned int hash;
+    int next;           // 같은 버킷의 다음 엔트리, 없으면 -1
+} MemoEntry;
+
+typedef struct MemoTable {
+    MemoEntry* entries; // 링 버퍼, 가득 차면 가장 오래된 엔트리를 내보낸다. 처음 저장할 때 만든다
+    int* buckets;
+    int capacity;
+    int count;
+    int oldest;
+    int arity;
+    long hits;
+    long misses;
+    long evictions;
+    int disabled;       // 적중률이 낮아 껐다. 이후로는 메모가 없는 함수처럼 호출되고 JIT 대상이 된다
+} MemoTable;
+
+typedef struct GlobalName {
+    char* name;
+    int declarations;
+    Function* function;
+} GlobalName;
+
+typedef struct PurityAnalysis {
+    GlobalName* globals;
+    size_t global_count;
+    size_t global_capacity;
+    char** assigned;            // 프로그램 어디에서든 대입되는 이름
+    size_t assigned_count;
+    size_t assigned_capacity;
+    char** locals;
+    size_t local_count;
+    size_t local_capacity;
+    Array* functions;
+    int* pure;
+    int* visited;               // 메모할 가치를 볼 때 이미 따라간 함수
+} PurityAnalysis;
+
+MemoTable* createMemoTable(int arity, int capacity);
+int isMemoizableArguments(Value* arguments, int arg_count);
+unsigned int memoHash(Value* arguments, int arg_count);
+MemoEntry* memoLookup(MemoTable* memo, Value* arguments, unsigned int hash);
+void memoStore(MemoTable* memo, Value* arguments, unsigned int hash, Value result);
+void memoRecordMiss(MemoTable* memo);
+static inline int memoActive(MemoTable* memo){
+    return memo != NULL && !memo->disabled;
+}
+void collectPurityFacts(PurityAnalysis* analysis, Array* statements, int top_level);
+int isPureFunction(PurityAnalysis* analysis, Function* function);
+Array* memoizePureFunctions(Array* statements, int capacity);
+void printMemoStats(Array* functions);
+
+int analyzeEscapingStmt(Stmt* stmt);
+int analyzeEscapingScopes(Array* statements);
+struct Compiler;
+void resolveVariablesExpr(struct Compiler* compiler, int param_count, Expr* expr);
+void resolveVariablesStmt(struct Compiler* compiler, int param_count, Stmt* stmt);
+void resolveVariablesFunction(Function* function);
+void resolveVariables(Array* statements);
+
+// Optimizer - end
+
+// Garbage collector - start
+
+#define GC_PINNED 0xffffffffu
+#define GC_DEFAULT_THRESHOLD (1024 * 1024)
+#define GC_DEFAULT_GROWTH 2.0
+
+typedef struct GarbageCollector {
+    int enabled; // 꺼져 있는 동안(파싱, 초기화) 만든 객체는 프로그램 끝까지 살아 있다
+    unsigned int epoch;
+    Object* objects;
+    Environment* environments;
+    size_t bytes_allocated;
+    size_t next_gc;
+    size_t threshold;
+    double growth;
+    // 루트: 실행 중인 블록의 환경, 평가 중인 임시 값
+    Environment** env_roots;
+    size_t env_root_count;
+    size_t env_root_capacity;
+    Value* temp_roots;
+    size_t temp_count;
+    size_t temp_capacity;
+    Object** gray;
+    size_t gray_count;
+    size_t gray_capacity;
+    Array* memo_functions;
+    long collections;
+    double total_pause;
+    double max_pause;
+    size_t bytes_freed;
+} GarbageCollector;
+
+GarbageCollector gc = {0, 0, NULL, NULL, 0, GC_DEFAULT_THRESHOLD, GC_DEFAULT_THRESHOLD, GC_DEFAULT_GROWTH,
+                       NULL, 0, 0, NULL, 0, 0, NULL, 0, 0, NULL, 0, 0.0, 0.0, 0};
+int gc_stats_flag = 0;
+
+size_t objectSize(Object* object);
+void trackObject(Object* object);
+void trackEnvironment(Environment* env);
+void pushEnvironmentRoot(Environment* env);
+void popEnvironmentRoot();
+void pushTempRoot(Value value);
+void markObject(Object* object);
+void markValue(Value value);
+void markEnvironment(Environment* env);
+void markRoots(Interpreter* interpreter);
+void traceReferences();
+void removeWhiteStrings();
+void sweep();
+void collectGarbage(Interpreter* interpreter);
+void printGcStats();
+
+// 로프처럼 식 안에서 만들어지고 곧 버려지는 객체는 nursery에서 포인터 증가만으로 할당한다.
+// 문장 경계를 넘어 살아남는 곳(환경, CSE 슬롯, 메모 테이블, 인자)에 저장될 때 힙으로 승격되고,
+// 평가 중인 임시 값이 nursery를 가리키지 않으면 문장 경계에서 통째로 비운다.
+#define NURSERY_SIZE (256 * 1024)
+
+typedef struct Nursery {
+    char* start;
+    char* top;
+    char* end;
+    size_t young_temp_low; // nursery 객체를 담은 가장 낮은 temp_roots 인덱스
+    long allocations;
+    long promotions;
+    long resets;
+    int disabled; // VM에는 문장 경계가 없어 비울 시점을 정할 수 없으므로 쓰지 않는다
+} Nursery;
+
+Nursery nursery = {NULL, NULL, NULL, SIZE_MAX, 0, 0, 0, 0};
+
+void* allocateYoung(size_t size);
+int isYoung(Object* object);
+Object* promoteObject(Object* object);
+Value promoteValue(Value value);
+void resetNursery();
+
+// Garbage collector - end
+
+// VM - start
+
+// run --vm: 문장 배열을 함수 단위의 바이트코드로 컴파일해서 스택 기반 VM으로 실행한다.
+// 함수는 전역 환경만 닫으므로, 지역 변수는 컴파일할 때 프레임 슬롯으로 정해지고
+// 지역에서 찾지 못한 이름만 실행 중에 전역 테이블에서 찾는다.
+// Lox 호출은 힙에 있는 프레임 배열과 값 스택만 늘리고 C 스택은 쓰지 않으므로,
+// 재귀 깊이는 8MB 스택이 아니라 --max-depth(기본 VM_MAX_DEPTH_DEFAULT)로만 제한된다.
+#define VM_STACK_INITIAL 1024
+#define VM_FRAMES_INITIAL 64
+#define VM_MAX_DEPTH_DEFAULT (1 << 22)
+
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO
+#endif
+
+typedef enum OpCode {
+    OP_CONSTANT, OP_NIL, OP_TRUE, OP_FALSE, OP_POP,
+    OP_GET_LOCAL, OP_SET_LOCAL, OP_DEFINE_LOCAL,
+    OP_GET_GLOBAL, OP_SET_GLOBAL, OP_DEFINE_GLOBAL,
+    OP_EQUAL, OP_NOT_EQUAL, OP_GREATER, OP_GREATER_EQUAL, OP_LESS, OP_LESS_EQUAL,
+    OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE, OP_NOT, OP_NEGATE,
+    OP_PRINT, OP_JUMP, OP_JUMP_IF_FALSE, OP_LOOP, OP_CALL, OP_TAIL_CALL, OP_FUNCTION, OP_RETURN
+} OpCode;
+
+typedef struct Chunk {
+    uint8_t* code;
+    int* lines;
+    int count;
+    int capacity;
+    Value* constants;     // 파싱 중에 만든 값이라 GC에 고정되어 있다
+    int constant_count;
+    int constant_capacity;
+    Function** functions; // OP_FUNCTION이 만드는 함수의 선언
+    int function_count;
+    int function_capacity;
+    int slot_count;       // 인자를 포함한 지역 변수 슬롯 수
+    int max_stack;        // 슬롯 위에 쌓이는 피연산자의 최대 깊이
+} Chunk;
+
+typedef struct Local {
+    Object* name;
+    int depth;
+} Local;
+
+// 지역 변수의 슬롯 결정은 클로저 엔진과 함께 쓴다 (클로저 엔진에서는 chunk가 NULL)
+typedef struct Compiler {
+    Chunk* chunk;
+    Local* locals;        // 슬롯 번호는 배열 인덱스와 같다
+    int local_count;
+    int local_capacity;
+    int slot_count;
+    int scope_depth;      // 0이면 전역
+    int stack_depth;
+    int line;
+} Compiler;
+
+typedef struct CallFrame {
+    Chunk* chunk;
+    uint8_t* ip;          // 호출한 쪽으로 돌아갈 위치, 실행 중인 프레임은 레지스터에만 있다
+    Value* slots;
+} CallFrame;
+
+typedef struct VM {
+    CallFrame* frames;
+    int frame_count;
+    int frame_capacity;
+    Value* stack;
+    Value* stack_top;     // 수집 직전에만 맞춰 둔다
+    size_t stack_capacity;
+    Interpreter* interpreter; // 전역 환경과 네이티브 함수 호출에 쓴다
+} VM;
+
+VM vm = {0};
+int vm_flag = 0;
+
+Chunk* createChunk();
+void writeChunk(Chunk* chunk, uint8_t byte, int line);
+int addConstant(Compiler* compiler, Value value);
+int addChunkFunction(Compiler* compiler, Function* function);
+int addGlobal(Compiler* compiler, Object* name);
+void compileError(Compiler* compiler, char* message);
+void emitByte(Compiler* compiler, uint8_t byte);
+void emitOp(Compiler* compiler, OpCode op, int stack_effect);
+void emitShort(Compiler* compiler, int operand);
+int emitJump(Compiler* compiler, OpCode op);
+void patchJump(Compiler* compiler, int offset);
+void emitLoop(Compiler* compiler, int loop_start);
+int resolveLocal(Compiler* compiler, Object* name);
+int declareLocal(Compiler* compiler, Object* name);
+void endScope(Compiler* compiler, int local_count);
+void compileExpr(Compiler* compiler, Expr* expr);
+void compileStmt(Compiler* compiler, Stmt* stmt);
+void compileStatements(Compiler* compiler, Array* statements);
+Chunk* compileFunction(Function* function);
+Chunk* compileScript(Array* statements);
+void vmRuntimeError(Chunk* chunk, uint8_t* ip, char* message);
+void ensureVmStack(size_t needed);
+void runVm(Interpreter* interpreter, Chunk* script);
+
+// VM - end
+
+// Closure compiler - start
+
+// run --closures: AST를 한 번 훑어서 노드마다 함수 포인터와 미리 정해 둔 피연산자를 가진 클로저로 바꾼다.
+// 리터럴 값, 변수 슬롯, 연산자 종류가 컴파일할 때 정해지므로 실행 중에는 Visitor 조회나
+// ElementType 분기, operator->type 비교 없이 클로저끼리 직접 호출한다. 슬롯 결정은 VM과 같은 Compiler를 쓴다.
+#define SLOT_CHUNK_SIZE 4096
+
+typedef struct ClosureNode {
+    union {
+        Value (*eval)(struct ClosureNode* self, Value* slots);
+        int (*exec)(struct ClosureNode* self, Value* slots); // 1이면 return으로 빠져나가는 중
+    };
+    Token* token;                  // 런타임 에러를 보고할 위치
+    Value constant;
+    Object* name;                  // 전역 변수 이름
+    int slot;                      // 지역 변수 슬롯, 전역이면 전역 테이블 슬롯
+    struct ClosureNode* left;      // 피연산자, 조건, 대입하는 값
+    struct ClosureNode* right;
+    struct ClosureNode* other;     // else 분기
+    struct ClosureNode** children; // 블록의 문장, 호출의 인자
+    int child_count;
+    Function* function;
+} ClosureNode;
+
+typedef struct ClosureCode {
+    ClosureNode* body;
+    int slot_count;
+} ClosureCode;
+
+// 지역 변수 슬롯은 옮겨지지 않는 덩어리에 쌓는다. 호출 중인 클로저가 슬롯 포인터를 들고 있기 때문이다
+typedef struct SlotChunk {
+    struct SlotChunk* prev;
+    struct SlotChunk* next;
+    size_t top;
+    Value values[SLOT_CHUNK_SIZE];
+} SlotChunk;
+
+SlotChunk* slot_stack = NULL;
+Interpreter* closure_interpreter = NULL;
+int closures_flag = 0;
+
+ClosureNode* createClosureNode(Token* token);
+Value closureConstant(ClosureNode* self, Value* slots);
+Value closureGetLocal(ClosureNode* self, Value* slots);
+Value closureGetGlobal(ClosureNode* self, Value* slots);
+Value closureSetLocal(ClosureNode* self, Value* slots);
+Value closureSetGlobal(ClosureNode* self, Value* slots);
+Value closureOr(ClosureNode* self, Value* slots);
+Value closureAnd(ClosureNode* self, Value* slots);
+Value closureNot(ClosureNode* self, Value* slots);
+Value closureNegate(ClosureNode* self, Value* slots);
+Value closureAdd(ClosureNode* self, Value* slots);
+Value closureSubtract(ClosureNode* self, Value* slots);
+Value closureMultiply(ClosureNode* self, Value* slots);
+Value closureDivide(ClosureNode* self, Value* slots);
+Value closureGreater(ClosureNode* self, Value* slots);
+Value closureGreaterEqual(ClosureNode* self, Value* slots);
+Value closureLess(ClosureNode* self, Value* slots);
+Value closureLessEqual(ClosureNode* self, Value* slots);
+Value closureEqual(ClosureNode* self, Value* slots);
+Value closureNotEqual(ClosureNode* self, Value* slots);
+Value closureCall(ClosureNode* self, Value* slots);
+Value closureFunction(ClosureNode* self, Value* slots);
+int closureExpressionStmt(ClosureNode* self, Value* slots);
+int closurePrintStmt(ClosureNode* self, Value* slots);
+int closureDefineLocal(ClosureNode* self, Value* slots);
+int closureDefineGlobal(ClosureNode* self, Value* slots);
+int closureBlock(ClosureNode* self, Value* slots);
+int closureIf(ClosureNode* self, Value* slots);
+int closureWhile(ClosureNode* self, Value* slots);
+int closureReturn(ClosureNode* self, Value* slots);
+int closureTailCall(ClosureNode* self, Value* slots);
+ClosureNode* compileClosureExpr(Compiler* compiler, Expr* expr);
+ClosureNode* compileClosureStmt(Compiler* compiler, Stmt* stmt);
+ClosureNode* compileClosureBlock(Compiler* compiler, Array* statements);
+ClosureCode* compileClosureFunction(Function* function);
+ClosureCode* compileClosureScript(Array* statements);
+Value* pushSlots(int count);
+void popSlots(int count);
+void markSlotStack();
+void closureSafePoint();
+Value callClosureCode(ClosureCode* code, Value* args, int arg_count);
+void runClosures(Interpreter* interpreter, ClosureCode* script);
+
+// Closure compiler - end
+
+// JIT - start
+
+// 트리 워커에서 자주 호출되거나 반복문이 오래 도는 함수를 x86-64 기계어로 옮긴다.
+// 식마다 정해진 템플릿을 내보내는 단순한 방식이라 레지스터 할당은 없고, 중간 값은 모두
+// 슬롯 스택의 프레임(지역 슬롯 뒤의 임시 슬롯)에 둔다. 그래서 GC가 프레임을 그대로 루트로 본다.
+// 숫자 연산과 비교는 인라인으로 처리하고, 그 밖의 경우(문자열 +, 전역 변수, 호출)는 C 함수를 부른다.
+// print, 함수 선언 같은 문장이 있으면 컴파일하지 않고 인터프리터에 남긴다.
+#define JIT_DEFAULT_THRESHOLD 1000
+
+typedef struct JitCode {
+    Value (*entry)(Value* slots);
+    int frame_size;       // 지역 슬롯과 임시 슬롯을 합한 수
+    size_t size;
+} JitCode;
+
+typedef struct JitAssembler {
+    Compiler compiler;    // 지역 슬롯 결정은 VM과 같다
+    uint8_t* code;
+    int count;
+    int capacity;
+    int temp_count;
+    int max_temps;
+    int rejected;
+    Function* function;   // 자기 자신을 꼬리 호출하면 body_start로 뛴다
+    int body_start;
+} JitAssembler;
+
+typedef struct Jit {
+    int enabled;
+    int threshold;
+    long compiled;
+    long rejected;
+    long entries;         // 기계어로 실행된 호출 수
+    size_t code_bytes;
+    size_t mapped_bytes;
+} Jit;
+
+#ifdef JIT_SUPPORTED
+Jit jit = {1, JIT_DEFAULT_THRESHOLD, 0, 0, 0, 0, 0};
+#else
+Jit jit = {0, JIT_DEFAULT_THRESHOLD, 0, 0, 0, 0, 0};
+#endif
+int jit_stats_flag = 0;
+Interpreter* jit_interpreter = NULL;
+Function* jit_active_function = NULL; // 반복 횟수를 셀 함수
+
+void jitEmit(JitAssembler* assembler, const uint8_t* bytes, int length);
+void jitEmitByte(JitAssembler* assembler, uint8_t byte);
+void jitEmitInt32(JitAssembler* assembler, int32_t value);
+void jitEmitImm64(JitAssembler* assembler, uint8_t reg, uint64_t value);
+void jitEmitCall(JitAssembler* assembler, void* function);
+void jitEmitSlot(JitAssembler* assembler, uint8_t rex, uint8_t opcode, uint8_t reg, int base_is_temp, int index);
+int jitEmitJump(JitAssembler* assembler, uint8_t condition);
+void jitPatchJump(JitAssembler* assembler, int offset);
+void jitEmitJumpBack(JitAssembler* assembler, int target);
+void jitEmitError(JitAssembler* assembler, Token* token, char* message);
+void jitEmitJumpIfFalse(JitAssembler* assembler, int* patches, int* patch_count);
+void jitEmitNumberCheck(JitAssembler* assembler, int check_left, int check_right, Token* token, char* message);
+int jitAllocateTemp(JitAssembler* assembler);
+Expr* jitUnwrap(Expr* expr);
+int jitIsLeaf(JitAssembler* assembler, Expr* expr);
+int jitIsNumberLiteral(Expr* expr);
+void jitCompileLeaf(JitAssembler* assembler, Expr* expr, uint8_t reg);
+void jitCompileOperands(JitAssembler* assembler, ExprBinary* binary);
+void jitCompileExpr(JitAssembler* assembler, Expr* expr);
+void jitCompileCondition(JitAssembler* assembler, Expr* expr, int* patches, int* patch_count);
+void jitCompileTailCall(JitAssembler* assembler, Call* call);
+void jitCompileStmt(JitAssembler* assembler, Stmt* stmt);
+JitCode* jitCompile(Function* function);
+void jitSafePoint(Value left, Value right);
+Value jitAdd(Value left, Value right, Token* token);
+Value jitEqual(Value left, Value right);
+Value jitGetGlobal(Token* name);
+Value jitSetGlobal(int slot, Value value, Token* name);
+Value jitCall(Value callee, Value* args, int arg_count, Token* paren);
+int jitIsSelfCall(Value callee, Function* function);
+Value jitTailCall(Value callee, Value* args, int arg_count, Token* paren);
+Value* pushJitFrame(JitCode* code, int arg_count);
+Value runJitCode(JitCode* code, Value* slots);
+void printJitStats();
+
+// JIT - end
+
 
 int main(int argc, char *argv[]) {
+    char stack_base_marker;
+    initStackGuard(&stack_base_marker);
     // Disable output buffering
     setbuf(stdout, NULL);
     setbuf(stderr, NULL);
 
     if (argc < 3) {
-        fprintf(stderr, "Usage: ./your_program tokenize <filename>\n");
+        fprintf(stderr, "Usage: ./your_program <command> [-O] [--vm (stackless: heap frames, depth limited only by --max-depth)] [--closures] [--memo-stats] [--memo-cap=N] [--gc-stats] [--gc-threshold=BYTES] [--gc-growth=F] [--slab-stats] [--heap-stats] [--max-heap=BYTES] [--no-jit] [--jit-threshold=N] [--jit-stats] [--call-stats] [--max-depth=N] <filename>\n");
         return 1;
     }
 
     const char *command = argv[1];
+    const char *filename = NULL;
+    int max_depth_arg = 0;
+    for (int i = 2; i < argc; i++){
+        if (strcmp(argv[i], "-O") == 0){
+            optimize_flag = 1;
+        } else if (strcmp(argv[i], "--memo-stats") == 0){
+            memo_stats_flag = 1;
+        } else if (strncmp(argv[i], "--memo-cap=", 11) == 0){
+            memo_capacity = atoi(argv[i] + 11);
+            if (memo_capacity < 1) memo_capacity = 1;
+        } else if (strcmp(argv[i], "--slab-stats") == 0){
+            slab_stats_flag = 1;
+        } else if (strcmp(argv[i], "--vm") == 0){
+            vm_flag = 1;
+        } else if (strcmp(argv[i], "--closures") == 0){
+            closures_flag = 1;
+        } else if (strcmp(argv[i], "--no-jit") == 0){
+            jit.enabled = 0;
+        } else if (strncmp(argv[i], "--jit-threshold=", 16) == 0){
+            jit.threshold = atoi(argv[i] + 16);
+            if (jit.threshold < 1) jit.threshold = 1;
+        } else if (strcmp(argv[i], "--jit-stats") == 0){
+            jit_stats_flag = 1;
+        } else if (strcmp(argv[i], "--call-stats") == 0){
+            call_stats_flag = 1;
+        } else if (strncmp(argv[i], "--max-depth=", 12) == 0){
+            max_depth_arg = atoi(argv[i] + 12);
+            if (max_depth_arg < 1) max_depth_arg = 1;
+        } else if (strcmp(argv[i], "--heap-stats") == 0){
+            heap_stats_flag = 1;
+        } else if (strncmp(argv[i], "--max-heap=", 11) == 0){
+            heap.limit = strtoull(argv[i] + 11, NULL, 10);
+            heap.collect_at = heap.limit / 2;
+        } else if (strcmp(argv[i], "--gc-stats") == 0){
+            gc_stats_flag = 1;
+        } else if (strncmp(argv[i], "--gc-threshold=", 15) == 0){
+            gc.threshold = strtoull(argv[i] + 15, NULL, 10);
+            gc.next_gc = gc.threshold;
+        } else if (strncmp(argv[i], "--gc-growth=", 12) == 0){
+            gc.growth = strtod(argv[i] + 12, NULL);
+            if (gc.growth < 1.0) gc.growth = 1.0;
+        } else {
+            filename = argv[i];
+        }
+    }
+    // 트리 워커는 C 스택을 지키기 위해 얕게 막고, 힙 프레임만 쓰는 VM은 훨씬 깊이 허용한다
+    if (max_depth_arg > 0) max_call_depth = max_depth_arg;
+    else if (vm_flag) max_call_depth = VM_MAX_DEPTH_DEFAULT;
+    if (filename == NULL) {
+        fprintf(stderr, "Usage: ./your_program <command> [-O] [--vm (stackless: heap frames, depth limited only by --max-depth)] [--closures] [--memo-stats] [--memo-cap=N] [--gc-stats] [--gc-threshold=BYTES] [--gc-growth=F] [--slab-stats] [--heap-stats] [--max-heap=BYTES] [--no-jit] [--jit-threshold=N] [--jit-stats] [--call-stats] [--max-depth=N] <filename>\n");
+        return 1;
+    }
 
     if (strcmp(command, "tokenize") == 0) {
         fprintf(stderr, "Logs from your program will appear here!\n");
         
-        char *file_contents = read_file_contents(argv[2]);
+        char *file_contents = read_file_contents(filename);
         if (strlen(file_contents) > 0) {
             int has_error = scanning(file_contents);
             
@@ -605,10 +1607,10 @@ int main(int argc, char *argv[]) {
             printf("EOF  null\n");
         } 
         
-        free(file_contents);
+        heapFree(file_contents);
     } 
     else if (strcmp(command, "parse") == 0){
-        char *file_contents = read_file_contents(argv[2]);
+        char *file_contents = read_file_contents(filename);
         if (strlen(file_contents) > 0) {
             int has_error = scanning(file_contents);
 
@@ -622,7 +1624,7 @@ int main(int argc, char *argv[]) {
             Array* statements = parser->parse(parser);
 
             if (had_error){
-                free(parser);
+                heapFree(parser);
                 releaseArray(statements);
                 exit(65);
             }
@@ -643,17 +1645,17 @@ int main(int argc, char *argv[]) {
             }
 
 
-            free(printer);
+            heapFree(printer);
             releaseArray(statements);
-            free(parser);
+            heapFree(parser);
             releaseTokenList();
         }
 
-        free(file_contents);
+        heapFree(file_contents);
 
     }
     else if (strcmp(command, "evaluate") == 0){
-        char *file_contents = read_file_contents(argv[2]);
+        char *file_contents = read_file_contents(filename);
         if (strlen(file_contents) > 0) {
             int has_error = scanning(file_contents);
 
@@ -667,7 +1669,7 @@ int main(int argc, char *argv[]) {
             Array* statements = parser->parse(parser);
 
             if (had_error){
-                free(parser);
+                heapFree(parser);
                 releaseArray(statements);
                 exit(65);
             }
@@ -687,17 +1689,17 @@ int main(int argc, char *argv[]) {
                 interpreter->interpretExpr(interpreter, expr);
             }
 
-            free(parser);
+            heapFree(parser);
             releaseArray(statements);
-            releaseHashTable(interpreter->environment->values);
-            free(interpreter);
+            releaseHashTable(&interpreter->environment->values);
+            heapFree(interpreter);
             releaseTokenList();
         }
 
-        free(file_contents);
+        heapFree(file_contents);
     }
     else if (strcmp(command, "run") == 0){
-        char *file_contents = read_file_contents(argv[2]);
+        char *file_contents = read_file_contents(filename);
         if (strlen(file_contents) > 0) {
             int has_error = scanning(file_contents);
 
@@ -711,22 +1713,54 @@ int main(int argc, char *argv[]) {
             Array* statements = parser->parse(parser);
 
             if (had_error){
-                free(parser);
+                heapFree(parser);
                 releaseArray(statements);
                 exit(65);
             }
 
             runtime_error_flag = 0;
             Interpreter* interpreter = createInterpreter();
-            interpreter->interpret(interpreter, statements);
-
-            free(parser);
+            foldConstants(statements);
+            analyzeEscapingScopes(statements);
+            if (!vm_flag && !closures_flag) resolveVariables(statements);
+            Array* memoized_functions = NULL;
+            if (optimize_flag && !vm_flag && !closures_flag){
+                int slot_count = eliminateCommonSubexpressions(statements);
+                interpreter->cse_slots = (Value*)heapCallocate(slot_count + 1, sizeof(Value), HEAP_VALUES);
+                interpreter->cse_slot_count = slot_count;
+                specializeNumericNodes(statements);
+                memoized_functions = memoizePureFunctions(statements, memo_capacity);
+            }
+            gc.memo_functions = memoized_functions;
+            if (vm_flag){
+                Chunk* script = compileScript(statements);
+                nursery.disabled = 1;
+                gc.enabled = 1;
+                runVm(interpreter, script);
+            } else if (closures_flag){
+                ClosureCode* script = compileClosureScript(statements);
+                nursery.disabled = 1;
+                gc.enabled = 1;
+                runClosures(interpreter, script);
+            } else {
+                jit_interpreter = interpreter;
+                gc.enabled = 1;
+                interpreter->interpret(interpreter, statements);
+            }
+            if (memo_stats_flag && memoized_functions) printMemoStats(memoized_functions);
+            if (gc_stats_flag) printGcStats();
+            if (slab_stats_flag) printSlabStats();
+            if (heap_stats_flag) printHeapStats();
+            if (jit_stats_flag) printJitStats();
+            if (call_stats_flag) printCallStats();
+
+            heapFree(parser);
             releaseArray(statements);
-            free(interpreter);
+            heapFree(interpreter);
             releaseTokenList();
         }
 
-        free(file_contents);
+        heapFree(file_contents);
     }
     else {
         fprintf(stderr, "Unknown command: %s\n", command);
@@ -747,7 +1781,7 @@ char *read_file_contents(const char *filename) {
     long file_size = ftell(file);
     rewind(file);
 
-    char *file_contents = malloc(file_size + 1);
+    char *file_contents = heapAllocate(file_size + 1, HEAP_TOKENS);
     if (file_contents == NULL) {
         fprintf(stderr, "Memory allocation failed\n");
         fclose(file);
@@ -757,7 +1791,7 @@ char *read_file_contents(const char *filename) {
     size_t bytes_read = fread(file_contents, 1, file_size, file);
     if (bytes_read < file_size) {
         fprintf(stderr, "Error reading file contents\n");
-        free(file_contents);
+        heapFree(file_contents);
         fclose(file);
         return NULL;
     }
@@ -967,54 +2001,69 @@ int scanning(const char *file_contents){
 }
 
 void* InterpreterVisitLiteralExpr(Visitor* self, Expr* expr){
-    ExprLiteral* expr_literal = (ExprLiteral*)expr;
-    
-    Object* object = createObject(expr_literal->type, expr_literal->value);
-    return object;
+    return VALUE_RESULT(((ExprLiteral*)expr)->constant);
+}
+
+Value literalConstant(TokenType type, char* value){
+    switch (type){
+        case NUMBER:
+            return NUMBER_VAL(strtod(value, NULL));
+        case STRING:
+            // 문자열은 변경되지 않으므로 평가할 때마다 새로 만들 필요가 없다
+            return OBJ_VAL(createObject(STRING, value));
+        case TRUE:
+            return TRUE_VAL;
+        case FALSE:
+            return FALSE_VAL;
+        default:
+            return NIL_VAL;
+    }
 }
 
 void* InterpreterVisitGroupingExpr(Visitor* self, Expr* expr){
     ExprGrouping* expr_grouping = (ExprGrouping*)expr;
 
-    return evaluate((Interpreter*)self, expr_grouping->expression);
+    return VALUE_RESULT(evaluate((Interpreter*)self, expr_grouping->expression));
 }
 
-Object* evaluate(struct Interpreter* self, Expr* expr){
-    return (Object*)expr->accept(expr, &self->base);
+Value evaluate(struct Interpreter* self, Expr* expr){
+    return RESULT_VALUE(expr->accept(expr, &self->base));
 }
 
 void execute(Interpreter* self, Stmt* stmt){
+    // 문장 경계에서만 수집하므로 식 평가 중인 값은 temp_roots에만 올려 두면 된다
+    if (nursery.top != nursery.start && gc.temp_count <= nursery.young_temp_low) resetNursery();
+    if (gc.bytes_allocated > gc.next_gc || (heap.limit && heap.total > heap.collect_at)) collectGarbage(self);
     stmt->accept(stmt, &self->stmt_visitor);
 }
 
 void* InterpreterVisitUnaryExpr(Visitor* self, Expr* expr){
     ExprUnary* expr_unary = (ExprUnary*)expr;
 
-    Object* right = evaluate((Interpreter*)self, expr_unary->right);
+    Value right = evaluate((Interpreter*)self, expr_unary->right);
     switch (expr_unary->operator->type){
         case MINUS:
-            RuntimeError* runtime_error = checkNumberOperand(*expr_unary->operator, *right);
-            if (runtime_error_flag) return runtime_error;
-            double number = (((NumberValue*)right->value)->number);
-            number = -number;
-            ((NumberValue*)right->value)->number = number;
-            return right;
+            checkNumberOperand(expr_unary->operator, right);
+            return VALUE_RESULT(NUMBER_VAL(-AS_NUMBER(right)));
         case BANG:
-            int is_truthy = isTruthy(right);
-            if (is_truthy){
-                return createObject(FALSE, "false");
-            }
-            return createObject(TRUE, "true");
+            return VALUE_RESULT(BOOL_VAL(!isTruthy(right)));
     }
 
-    return NULL;
+    return VALUE_RESULT(NIL_VAL);
 }
 
 void* InterpreterVisitVariableExpr(Visitor* self, Expr* expr){
     size_t base_offset = offsetof(Interpreter, base);
     Interpreter* interpreter = (Interpreter*)((char*)self - base_offset);
+    Variable* variable = (Variable*)expr;
+    if (variable->slot >= 0) return VALUE_RESULT(interpreter->slots[variable->slot]);
+    if (variable->global_slot >= 0){
+        Value value = global_table.values[variable->global_slot];
+        if (value == UNDEFINED_VAL) undefinedVariable(variable->name);
+        return VALUE_RESULT(value);
+    }
     Environment* environment = interpreter->environment;
-    return environment->get(environment, ((Variable*)expr)->name);
+    return VALUE_RESULT(environment->get(environment, variable->name));
 }
 
 void* InterpreterVisitAssignExpr(Visitor* self, Expr* expr){
@@ -1024,110 +2073,180 @@ void* InterpreterVisitAssignExpr(Visitor* self, Expr* expr){
     Interpreter* interpreter = (Interpreter*)((char*)self - base_offset);
     Environment* environment = interpreter->environment;
     
-    Object* value = evaluate((Interpreter*)self, expr_assign->value);
+    Value value = promoteValue(evaluate((Interpreter*)self, expr_assign->value));
 
-    environment->assign(environment, expr_assign->name, value);
-    return value;
+    if (expr_assign->slot >= 0){
+        interpreter->slots[expr_assign->slot] = value;
+    } else if (expr_assign->global_slot >= 0){
+        setGlobal(expr_assign->global_slot, expr_assign->name, value);
+    } else {
+        environment->assign(environment, expr_assign->name, value);
+    }
+    return VALUE_RESULT(value);
 }
 
 void* InterpreterVisitLogicalExpr(Visitor* self, Expr* expr){
     Logical* expr_logical = (Logical*)expr;
-    Object* left = evaluate((Interpreter*)self, expr_logical->left);
+    Value left = evaluate((Interpreter*)self, expr_logical->left);
 
     if (expr_logical->operator->type == OR){
-        if (isTruthy(left)) return left;
+        if (isTruthy(left)) return VALUE_RESULT(left);
     } else {
-        if (!isTruthy(left)) return left;
+        if (!isTruthy(left)) return VALUE_RESULT(left);
     }
-    return evaluate((Interpreter*)self, expr_logical->right);
+    return VALUE_RESULT(evaluate((Interpreter*)self, expr_logical->right));
+}
+
+void* InterpreterVisitCseDefExpr(Visitor* self, Expr* expr){
+    CseDef* cse_def = (CseDef*)expr;
+    Value value = promoteValue(evaluate((Interpreter*)self, cse_def->expression));
+    ((Interpreter*)self)->cse_slots[cse_def->slot] = value;
+    return VALUE_RESULT(value);
+}
+
+void* InterpreterVisitCseUseExpr(Visitor* self, Expr* expr){
+    return VALUE_RESULT(((Interpreter*)self)->cse_slots[((CseUse*)expr)->slot]);
 }
 
 void* InterpreterVisitCallExpr(Visitor* self, Expr* expr){
     Call* expr_call = (Call*)expr;
-    Object* callee = evaluate((Interpreter*)self, expr_call->callee);
-
-    Array* args = createArray(INITIAL_LIST_SIZE);
-    for (int i = 0; i < expr_call->arguments->count; i++){
-        Element* element = getElement(expr_call->arguments, i);
-        Expression* expr_stmt = element->data.expr_stmt;
-        Expr* expr = expr_stmt->expression;
+    Interpreter* interpreter = (Interpreter*)self;
+    int arg_count = expr_call->arguments->count;
+    size_t temp_count = gc.temp_count;
+    Value callee;
+    LoxCallable* lox_callable;
+    Value* args = evaluateCall(interpreter, expr_call, &callee, &lox_callable);
+    if (interpreter->call_depth >= max_call_depth || stackExhausted()) runtimeError(expr_call->paren, "Stack overflow.");
+    interpreter->call_depth++;
+    Value result = lox_callable->call(lox_callable, interpreter, args, arg_count);
+    interpreter->call_depth--;
+    popSlots(arg_count);
+    gc.temp_count = temp_count;
+    return VALUE_RESULT(result);
+}
+
+Value* evaluateCall(Interpreter* interpreter, Call* expr_call, Value* callee_out, LoxCallable** callable_out){
+    // 호출 대상은 임시 루트로, 인자는 값 스택에 올려 둔다. 부른 쪽이 gc.temp_count와 값 스택을 되돌린다
+    Value callee;
+    if (expr_call->global_callee && expr_call->cache_version == globals_version){
+        // 전역 이름이 그 뒤로 바뀌지 않았으면 환경을 찾지 않고, 이미 검사한 함수를 그대로 부른다
+        call_cache.hits++;
+        callee = expr_call->cached_callee;
+        pushTempRoot(callee);
+        *callee_out = callee;
+        *callable_out = (LoxCallable*)AS_OBJ(callee)->value;
+        return pushCallArguments(interpreter, expr_call->arguments);
+    }
+    // 인자를 평가하다가 전역이 바뀔 수 있으므로 찾기 전의 버전을 적는다
+    unsigned int version = globals_version;
+    callee = evaluate(interpreter, expr_call->callee);
+    pushTempRoot(callee);
+    Value* args = pushCallArguments(interpreter, expr_call->arguments);
+    LoxCallable* lox_callable;
+    if (IS_FUNCTION(callee) && expr_call->cached_declaration != NULL
+        && ((LoxFunction*)AS_OBJ(callee)->value)->declaration == expr_call->cached_declaration){
+        // 지역 변수나 인자로 받은 함수는 선언이 같으면 인자 수도 같으므로 검사를 건너뛴다
+        call_cache.hits++;
+        lox_callable = (LoxCallable*)AS_OBJ(callee)->value;
+    } else {
+        lox_callable = checkCallable(callee, expr_call->paren, expr_call->arguments->count);
+        call_cache.misses++;
+        if (expr_call->cache_misses == 0) call_cache.sites++;
+        if (expr_call->cache_misses == 1) call_cache.polymorphic_sites++;
+        if (expr_call->cache_misses < 2) expr_call->cache_misses++;
+        expr_call->cached_declaration = ((LoxFunction*)lox_callable)->declaration;
+    }
+    if (expr_call->global_callee){
+        expr_call->cached_callee = callee;
+        expr_call->cache_version = version;
+    }
+    *callee_out = callee;
+    *callable_out = lox_callable;
+    return args;
+}
+
+Value* pushCallArguments(Interpreter* interpreter, Array* arguments){
+    // 인자는 값 스택에 바로 평가해서 호출된 함수의 프레임이 되게 한다. 수집 중에 읽혀도 되도록 먼저 nil로 채운다
+    int arg_count = arguments->count;
+    Value* args = pushSlots(arg_count);
+    for (int i = 0; i < arg_count; i++) args[i] = NIL_VAL;
+    for (int i = 0; i < arg_count; i++){
+        Element* element = getElement(arguments, i);
+        // 인자는 프레임에 남아 문장 경계를 넘으므로 미리 승격해 둔다
+        args[i] = promoteValue(evaluate(interpreter, element->data.expr_stmt->expression));
+    }
+    return args;
+}
 
-        Element new_elem;
-        new_elem.type = OBJECT;
-        new_elem.data.object = evaluate((Interpreter*)self, expr);
-        addElement(args, new_elem); 
+LoxCallable* checkCallable(Value callee, Token* paren, int arg_count){
+    if (!IS_OBJ(callee) || AS_OBJ(callee)->type != FUN){
+        runtimeError(paren, "Can only call functions and classes.");
+    }
+    LoxCallable* lox_callable = (LoxCallable*)AS_OBJ(callee)->value;
+    int expected = lox_callable->arity(lox_callable);
+    if (arg_count != expected){
+        char message[64];
+        snprintf(message, sizeof(message), "Expected %d arguments but got %zu.", expected, (size_t)arg_count);
+        runtimeError(paren, message);
     }
-    LoxCallable* lox_callable = (LoxCallable*)callee->value;
-    return lox_callable->call(lox_callable, (Interpreter*)self, args);
+    return lox_callable;
 }
 
 
-RuntimeError* checkNumberOperand(Token operator, Object operand){
-    if (operand.type == NUMBER) return NULL;
-    runtime_error_flag = 1;
-    return createRuntimeError(operator, "Operand must be a number.");
+void checkNumberOperand(Token* operator, Value operand){
+    if (IS_NUMBER(operand)) return;
+    runtimeError(operator, "Operand must be a number.");
 }
 
-RuntimeError* checkNumberOperands(Token operator, Object left, Object right){
-    if (left.type == NUMBER && right.type == NUMBER) return NULL;
-    runtime_error_flag = 1;
-    return createRuntimeError(operator, "Operands must be numbers.");
+void checkNumberOperands(Token* operator, Value left, Value right){
+    if (IS_NUMBER(left) && IS_NUMBER(right)) return;
+    runtimeError(operator, "Operands must be numbers.");
 }
 
 
-int isTruthy(Object* object){
-    if (object->type == NIL){
-        return 0;
-    }
-    if (object->type == TRUE || object->type == FALSE){
-        return ((BoolValue*)object->value)->boolean;
-    }
-    return 1;
+int isTruthy(Value value){
+    // nil과 false는 프로세스 전체에서 하나뿐인 상수라 비트 비교로 충분하다
+    return value != NIL_VAL && value != FALSE_VAL;
 }
 
-Object* quotientOperation(Object* left, Object* right){
-    double left_value = (((NumberValue*)left->value)->number);
-    double right_value = (((NumberValue*)right->value)->number);
-    double result = left_value / right_value;
-    char* buffer = (char*)malloc(sizeof(32));
-    snprintf(buffer, 32, "%.6f", result);
-    return createObject(NUMBER, buffer);
+Value quotientOperation(Value left, Value right){
+    return NUMBER_VAL(AS_NUMBER(left) / AS_NUMBER(right));
 };
-Object* multiplyOperation(Object* left, Object* right){
-    double left_value = (((NumberValue*)left->value)->number);
-    double right_value = (((NumberValue*)right->value)->number);
-    double result = left_value * right_value;
-    char* buffer = (char*)malloc(sizeof(32));
-    snprintf(buffer, 32, "%.6f", result);
-    return createObject(NUMBER, buffer);
+Value multiplyOperation(Value left, Value right){
+    return NUMBER_VAL(AS_NUMBER(left) * AS_NUMBER(right));
 };
 
-Object* plusOperation(Object* left, Object* right){
-    if (left->type == NUMBER && right->type == NUMBER){
-        double left_value = (((NumberValue*)left->value)->number);
-        double right_value = (((NumberValue*)right->value)->number);
-        double result = left_value + right_value;
-        char* buffer = (char*)malloc(sizeof(32));
-        snprintf(buffer, 32, "%.6f", result);
-        return createObject(NUMBER, buffer);    
-    }
-    if (left->type == STRING && right->type == STRING){
-        char* left_value = (((StringValue*)left->value)->string);
-        char* right_value = (((StringValue*)right->value)->string);
-        char* buffer = (char*)malloc(strlen(left_value)*sizeof(char) + strlen(right_value)*sizeof(char) -1); 
-        strcat(left_value, right_value);
-        return createObject(STRING, left_value);
+Value numberPlusOperation(Value left, Value right){
+    return NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+}
+
+Value numberEqualOperation(Value left, Value right, int negate){
+    int equal = (AS_NUMBER(left) == AS_NUMBER(right)) != negate;
+    return BOOL_VAL(equal);
+}
+
+int plusOperation(Value left, Value right, Value* result){
+    if (IS_NUMBER(left) && IS_NUMBER(right)){
+        *result = numberPlusOperation(left, right);
+        return 1;
     }
-    return NULL;
+    if (!(IS_STRING(left) || IS_ROPE(left)) || !(IS_STRING(right) || IS_ROPE(right))) return 0;
+
+    size_t left_length = stringLength(AS_OBJ(left));
+    size_t right_length = stringLength(AS_OBJ(right));
+    if (IS_ROPE(left) || IS_ROPE(right) || left_length + right_length >= ROPE_MIN_LENGTH){
+        *result = OBJ_VAL(createRope(AS_OBJ(left), AS_OBJ(right)));
+        return 1;
+    }
+    char buffer[ROPE_MIN_LENGTH];
+    memcpy(buffer, AS_CSTRING(left), left_length);
+    memcpy(buffer + left_length, AS_CSTRING(right), right_length);
+    *result = OBJ_VAL(internString(buffer, left_length + right_length));
+    return 1;
 }
 
-Object* minusOperation(Object* left, Object* right){
-    double left_value = (((NumberValue*)left->value)->number);
-    double right_value = (((NumberValue*)right->value)->number);
-    double result = left_value - right_value;
-    char* buffer = (char*)malloc(sizeof(32));
-    snprintf(buffer, 32, "%.6f", result);
-    return createObject(NUMBER, buffer);
+Value minusOperation(Value left, Value right){
+    return NUMBER_VAL(AS_NUMBER(left) - AS_NUMBER(right));
 }
 
 int isGreater(double left, double right){
@@ -1146,91 +2265,144 @@ int isLessEqual(double left, double right){
     return left <= right;
 }
 
-Object* relationalOperation(Object* left, Object* right, int (*comparison)(double, double)){
-    double left_value = (((NumberValue*)left->value)->number);
-    double right_value = (((NumberValue*)right->value)->number);
-    TokenType result = comparison(left_value, right_value) ? TRUE : FALSE;
-    char* literal = result == TRUE ? "TRUE": "FALSE";
-    return createObject(result, literal);
+Value relationalOperation(Value left, Value right, int (*comparison)(double, double)){
+    return BOOL_VAL(comparison(AS_NUMBER(left), AS_NUMBER(right)));
 }
 
-TokenType isEqual(Object* left, Object* right){
-    if (left->type == NIL && right->type == NIL) return TRUE;
-    if (left->type != right->type) return FALSE;
-
-    if (left->type == STRING){
-        char* left_value = ((StringValue*)left->value)->string;
-        char* right_value = ((StringValue*)right->value)->string;
-        return strcmp(left_value, right_value) == 0 ? TRUE : FALSE;
-    }
-    if (left->type == NUMBER){
-        double left_value = (((NumberValue*)left->value)->number);
-        double right_value = (((NumberValue*)right->value)->number);
-        return left_value == right_value ? TRUE: FALSE;   
-    }
-    if (left->type == TRUE && right->type == TRUE) return TRUE;
-    if (left->type == FALSE && right->type == FALSE) return TRUE;
+int isEqual(Value left, Value right){
+    if (IS_NUMBER(left) && IS_NUMBER(right)) return AS_NUMBER(left) == AS_NUMBER(right);
+    left = flattenValue(left);
+    right = flattenValue(right);
+    // nil, true, false, 함수, 인턴된 문자열은 같은 값이면 비트도 같다
+    return left == right;
 }
 
 void* InterpreterVisitBinaryExpr(Visitor* self, Expr* expr){
     Interpreter* interpreter = (Interpreter*)self;
     ExprBinary* expr_binary = (ExprBinary*)expr;
-    Object* left = evaluate(interpreter, expr_binary->left);
-    Object* right = evaluate(interpreter, expr_binary->right);
+    Value left = evaluate(interpreter, expr_binary->left);
+    size_t temp_count = gc.temp_count;
+    if (IS_OBJ(left)) pushTempRoot(left);
+    Value right = evaluate(interpreter, expr_binary->right);
+    gc.temp_count = temp_count;
+
+    if (IS_NUMBER(left) && IS_NUMBER(right)) quickenBinaryExpr(expr_binary);
+    return VALUE_RESULT(binaryOperation(interpreter, expr_binary, left, right));
+}
+
+const NumberOperator* findNumberOperator(const NumberOperator* operators, int count, TokenType type){
+    for (int i = 0; i < count; i++){
+        if (operators[i].type == type) return &operators[i];
+    }
+    return NULL;
+}
+
+int isNumberOperatorAccept(const NumberOperator* operators, int count, void* (*accept)(Expr*, Visitor*)){
+    for (int i = 0; i < count; i++){
+        if (operators[i].accept == accept) return 1;
+    }
+    return 0;
+}
+
+void quickenBinaryExpr(ExprBinary* expr_binary){
+    const NumberOperator* number_operator = findNumberOperator(guarded_number_operators, GUARDED_NUMBER_OPERATOR_COUNT, expr_binary->operator->type);
+    if (number_operator) expr_binary->base.accept = number_operator->accept;
+}
+
+int isGuardedNumberExpr(Expr* expr){
+    return isNumberOperatorAccept(guarded_number_operators, GUARDED_NUMBER_OPERATOR_COUNT, expr->accept);
+}
 
-    RuntimeError* runtime_error;
+Value binaryOperation(Interpreter* interpreter, ExprBinary* expr_binary, Value left, Value right){
     switch (expr_binary->operator->type)
     {
         case MINUS:
-            runtime_error = checkNumberOperands(*expr_binary->operator, *left, *right);
-            if (runtime_error) return runtime_error;
+            checkNumberOperands(expr_binary->operator, left, right);
             return minusOperation(left, right);
         case PLUS:
-            Object* object = plusOperation(left, right);
-            if (object) return object;
-
-            runtime_error_flag = 1;
-            runtime_error = createRuntimeError(*expr_binary->operator,
-                                             "Operands must be two numbers or two strings.");
+            Value result;
+            if (plusOperation(left, right, &result)) return result;
 
-            return runtime_error;
+            runtimeError(expr_binary->operator, "Operands must be two numbers or two strings.");
+            return NIL_VAL;
         case SLASH:
-            runtime_error = checkNumberOperands(*expr_binary->operator, *left, *right);
-            if (runtime_error) return runtime_error;
-
+            checkNumberOperands(expr_binary->operator, left, right);
             return quotientOperation(left, right);
         case STAR:
-            runtime_error = checkNumberOperands(*expr_binary->operator, *left, *right);
-            if (runtime_error) return runtime_error;
-
+            checkNumberOperands(expr_binary->operator, left, right);
             return multiplyOperation(left, right);
         case GREATER:
-            runtime_error = checkNumberOperands(*expr_binary->operator, *left, *right);
-            if (runtime_error) return runtime_error;
-
+            checkNumberOperands(expr_binary->operator, left, right);
             return relationalOperation(left, right, isGreater);
         case GREATER_EQUAL:
-            runtime_error = checkNumberOperands(*expr_binary->operator, *left, *right);
-            if (runtime_error) return runtime_error;
-
+            checkNumberOperands(expr_binary->operator, left, right);
             return relationalOperation(left, right, isGreaterEqual);
         case LESS:
-            runtime_error = checkNumberOperands(*expr_binary->operator, *left, *right);
-            if (runtime_error) return runtime_error;
-
+            checkNumberOperands(expr_binary->operator, left, right);
             return relationalOperation(left, right, isLess);
         case LESS_EQUAL:
-            runtime_error = checkNumberOperands(*expr_binary->operator, *left, *right);
-            if (runtime_error) return runtime_error;
-
+            checkNumberOperands(expr_binary->operator, left, right);
             return relationalOperation(left, right, isLessEqual);
         case BANG_EQUAL:
-            return isEqual(left, right) == TRUE ? createObject(FALSE, "FALSE") : createObject(TRUE, "TRUE");
+            return BOOL_VAL(!isEqual(left, right));
         case EQUAL_EQUAL:
-            return isEqual(left, right) == TRUE ? createObject(TRUE, "TRUE") : createObject(FALSE, "FALSE");
+            return BOOL_VAL(isEqual(left, right));
     }
+    return NIL_VAL;
+}
+
+// 특수화한 노드는 타입 추론이 이미 숫자임을 보였으므로 검사 없이 바로 계산한다
+#define NUMBER_EXPR(name, type, operation) \
+    void* InterpreterVisitNumber##name##Expr(Visitor* self, Expr* expr){ \
+        ExprBinary* expr_binary = (ExprBinary*)expr; \
+        Value left = evaluate((Interpreter*)self, expr_binary->left); \
+        Value right = evaluate((Interpreter*)self, expr_binary->right); \
+        return VALUE_RESULT(operation); \
+    } \
+    void* ExprNumber##name##Accept(Expr* self, Visitor *visitor){ \
+        return visitor->visitNumber##name##Expr(visitor, self); \
+    }
+
+NUMBER_BINARY_OPERATIONS(NUMBER_EXPR)
+NUMBER_EXPR(Equal, EQUAL_EQUAL, numberEqualOperation(left, right, 0))
+NUMBER_EXPR(NotEqual, BANG_EQUAL, numberEqualOperation(left, right, 1))
+
+#undef NUMBER_EXPR
+
+void* InterpreterVisitNumberNegateExpr(Visitor* self, Expr* expr){
+    Value right = evaluate((Interpreter*)self, ((ExprUnary*)expr)->right);
+    return VALUE_RESULT(NUMBER_VAL(-AS_NUMBER(right)));
+}
+
+// 가드가 붙은 노드는 두 피연산자가 숫자인지만 확인하고, 아니면 일반 이항식으로 되돌아가 그 자리에서 계산한다
+static inline int evaluateGuardedOperands(Interpreter* interpreter, ExprBinary* expr_binary, Value* left, Value* right){
+    *left = evaluate(interpreter, expr_binary->left);
+    size_t temp_count = gc.temp_count;
+    if (IS_OBJ(*left)) pushTempRoot(*left);
+    *right = evaluate(interpreter, expr_binary->right);
+    gc.temp_count = temp_count;
+    if (IS_NUMBER(*left) && IS_NUMBER(*right)) return 1;
+    expr_binary->base.accept = ExprBinaryAccept;
+    return 0;
 }
 
+// 연산자마다 방문 함수와 accept가 따로 있어야 노드를 바꿔 끼우는 것만으로 빠른 경로로 들어온다
+#define GUARDED_NUMBER_EXPR(name, type, operation) \
+    void* InterpreterVisitGuardedNumber##name##Expr(Visitor* self, Expr* expr){ \
+        Value left, right; \
+        if (!evaluateGuardedOperands((Interpreter*)self, (ExprBinary*)expr, &left, &right)){ \
+            return VALUE_RESULT(binaryOperation((Interpreter*)self, (ExprBinary*)expr, left, right)); \
+        } \
+        return VALUE_RESULT(operation); \
+    } \
+    void* ExprGuardedNumber##name##Accept(Expr* self, Visitor *visitor){ \
+        return visitor->visitGuardedNumber##name##Expr(visitor, self); \
+    }
+
+NUMBER_BINARY_OPERATIONS(GUARDED_NUMBER_EXPR)
+
+#undef GUARDED_NUMBER_EXPR
+
 void interpret(struct Interpreter* self, Array* statements){
     for (int i = 0; i < statements->count; i++){
         Element* element = getElement(statements, i);
@@ -1253,26 +2425,20 @@ void interpret(struct Interpreter* self, Array* statements){
             stmt = (Stmt*)element->data.return_stmt;
         }
         execute(self, stmt);
-        if (runtime_error_flag){
-            exit(70);
-        }
+        // 최상위의 return은 스크립트를 끝낸다
+        if (self->returning) return;
     }
 }
 
 void interpretExpr(struct Interpreter* self, Expr* expr){
-    Object* object = evaluate(self, expr);
-    if (runtime_error_flag){
-        RuntimeError* runtime_error = (RuntimeError*)object;
-        fprintf(stderr, "%s\n [line %d ]", runtime_error->message, runtime_error->token.line);
-        exit(70);
-    } else {
-        printf("%s\n", stringify(*object));
-    }
+    Value value = evaluate(self, expr);
+    printf("%s\n", stringify(value));
 }
 
 void executeBlock(Interpreter* self, Array* statements, Environment* env){
     Environment* previous = self->environment;
     self->environment = env;
+    pushEnvironmentRoot(env);
 
     for (int i = 0; i < statements->count; i++){
         Element* element = getElement(statements, i);
@@ -1295,32 +2461,31 @@ void executeBlock(Interpreter* self, Array* statements, Environment* env){
             stmt = (Stmt*)element->data.return_stmt;
         }
         execute(self, stmt);
+        if (self->returning) break;
     }
 
+    popEnvironmentRoot();
     self->environment = previous;
-    if (runtime_error_flag){
-        exit(70);
-    }
 }
 
 
-char* stringify(Object object){
-    if (object.value == NULL) return "nil";
+char* stringify(Value value){
+    if (IS_NIL(value)) return "nil";
 
-    if (object.type == NUMBER){
-        double number = (((NumberValue*)object.value)->number);
-        char* buffer = (char*)malloc(32);
-        snprintf(buffer, 32, "%.10g", number);
+    if (IS_NUMBER(value)){
+        // 호출자는 바로 출력하고 버리므로 정적 버퍼를 재사용한다
+        static char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.10g", AS_NUMBER(value));
         return buffer;
     }
-    if (object.type == STRING) {
-        return ((StringValue*)object.value)->string;
+    if (IS_BOOL(value)) {
+        return AS_BOOL(value) ? "true" : "false";
     }
-    if (object.type == TRUE || object.type == FALSE) {
-        return ((BoolValue*)object.value)->boolean != 0 ? "true" : "false";
+    if (IS_STRING(value) || IS_ROPE(value)) {
+        return AS_CSTRING(flattenValue(value));
     }
-    if (object.type == FUN){
-        LoxFunction* lox_function = (LoxFunction*)object.value;
+    if (IS_FUNCTION(value)){
+        LoxFunction* lox_function = (LoxFunction*)AS_OBJ(value)->value;
         return lox_function->toString(lox_function);
     }
     exit(70);
@@ -1340,8 +2505,8 @@ int endsWith(char *c, size_t c_size, char *end, size_t end_size){
 
 
 void initTokenList() {
-    g_head_pointer = (Token *)malloc(sizeof(Token));
-    g_tail_pointer = (Token *)malloc(sizeof(Token));
+    g_head_pointer = (Token *)heapAllocate(sizeof(Token), HEAP_TOKENS);
+    g_tail_pointer = (Token *)heapAllocate(sizeof(Token), HEAP_TOKENS);
     g_head_pointer->next = g_tail_pointer;
     g_tail_pointer->prev = g_head_pointer;
 }
@@ -1361,29 +2526,33 @@ int releaseTokenList() {
     while (now != g_tail_pointer) {
       Token *prev = now;
       now = now->next;
-      free(prev);
+      heapFree(prev->lexeme);
+      heapFree(prev->literal);
+      heapFree(prev);
     }
-    free(g_head_pointer);
-    free(g_tail_pointer);
+    heapFree(g_head_pointer);
+    heapFree(g_tail_pointer);
     g_token_list_size = 0;
   }
 }
 Token* createToken(TokenType type, char *lexeme, char *literal, int line) {
-    Token *new_token = (Token *)malloc(sizeof(Token));
+    Token *new_token = (Token *)heapAllocate(sizeof(Token), HEAP_TOKENS);
     
     new_token->type = type;
-    new_token->lexeme = strdup(lexeme);
-    new_token->literal = strdup(literal);
+    new_token->lexeme = heapStrdup(lexeme, HEAP_TOKENS);
+    new_token->literal = heapStrdup(literal, HEAP_TOKENS);
+    new_token->name = type == IDENTIFIER ? internString(lexeme, strlen(lexeme)) : NULL;
     new_token->line = line;
     return new_token;
 }
 
 int insertAtTail(TokenType type, char *lexeme, char *literal, int line) {
-    Token *new_token = (Token *)malloc(sizeof(Token));
+    Token *new_token = (Token *)heapAllocate(sizeof(Token), HEAP_TOKENS);
     
     new_token->type = type;
-    new_token->lexeme = strdup(lexeme);
-    new_token->literal = strdup(literal);
+    new_token->lexeme = heapStrdup(lexeme, HEAP_TOKENS);
+    new_token->literal = heapStrdup(literal, HEAP_TOKENS);
+    new_token->name = type == IDENTIFIER ? internString(lexeme, strlen(lexeme)) : NULL;
     new_token->line = line;
 
     Token *original_last_node = g_tail_pointer->prev;
@@ -1531,55 +2700,62 @@ int match(Parser *self, TokenType* types, size_t num_types){
 
 Expr* primary(Parser *self){
     if (match(self, (TokenType[]){FALSE}, 1)){
-        ExprLiteral* expr = malloc(sizeof(ExprLiteral));
+        ExprLiteral* expr = heapAllocate(sizeof(ExprLiteral), HEAP_AST);
         expr->base.accept = ExprLiteralAccept;
         expr->type = FALSE;
         expr->value = "false";
+        expr->constant = literalConstant(expr->type, expr->value);
         return (Expr *)expr;
     }
     if (match(self, (TokenType[]){TRUE}, 1)){
-        ExprLiteral* expr = malloc(sizeof(ExprLiteral));
+        ExprLiteral* expr = heapAllocate(sizeof(ExprLiteral), HEAP_AST);
         expr->base.accept = ExprLiteralAccept;
         expr->type = TRUE;
         expr->value = "true";
+        expr->constant = literalConstant(expr->type, expr->value);
         return (Expr *)expr;
     }
     if (match(self, (TokenType[]){NIL}, 1)){
-        ExprLiteral* expr = malloc(sizeof(ExprLiteral));
+        ExprLiteral* expr = heapAllocate(sizeof(ExprLiteral), HEAP_AST);
         expr->base.accept = ExprLiteralAccept;
         expr->type = NIL;
         expr->value = "nil";
+        expr->constant = literalConstant(expr->type, expr->value);
         return (Expr *)expr;
     }
     // TODO: NUMBER, STRING 합치기
     if (match(self, (TokenType[]){NUMBER}, 1)){
-        ExprLiteral* expr = malloc(sizeof(ExprLiteral));
+        ExprLiteral* expr = heapAllocate(sizeof(ExprLiteral), HEAP_AST);
         expr->base.accept = ExprLiteralAccept;
         expr->type = NUMBER;
         expr->value = previous(self)->literal;
+        expr->constant = literalConstant(expr->type, expr->value);
         return (Expr *)expr;
     }
     if (match(self, (TokenType[]){STRING}, 1)){
-        ExprLiteral* expr = malloc(sizeof(ExprLiteral));
+        ExprLiteral* expr = heapAllocate(sizeof(ExprLiteral), HEAP_AST);
         expr->base.accept = ExprLiteralAccept;
         expr->type = STRING;
         expr->value = previous(self)->literal;
+        expr->constant = literalConstant(expr->type, expr->value);
         return (Expr *)expr;
     }
 
     if (match(self, (TokenType[]){LEFT_PAREN}, 1)){
         Expr* expr = expression(self);
         consume(self, RIGHT_PAREN, "Expect ')' after expression.");
-        ExprGrouping* expr_grouping = malloc(sizeof(ExprGrouping));
+        ExprGrouping* expr_grouping = heapAllocate(sizeof(ExprGrouping), HEAP_AST);
         expr_grouping->base.accept = ExprGroupingAccept;
         expr_grouping->expression = expr;
         return (Expr *)expr_grouping;
     }
     if (match(self, (TokenType[]){IDENTIFIER}, 1)){
         // todo: Variable Expression
-        Variable* expr_var = malloc(sizeof(Variable));
+        Variable* expr_var = heapAllocate(sizeof(Variable), HEAP_AST);
         expr_var->base.accept = ExprVariableAccept;
         expr_var->name = previous(self);
+        expr_var->slot = -1;
+        expr_var->global_slot = -1;
         return (Expr *)expr_var;
     }
 
@@ -1591,7 +2767,7 @@ Expr* unary(Parser *self){
     if (match(self, (TokenType[]){BANG, MINUS}, 2)){
         Token* operator = previous(self);
         Expr* right = unary(self);
-        ExprUnary* expr_unary = malloc(sizeof(ExprUnary));
+        ExprUnary* expr_unary = heapAllocate(sizeof(ExprUnary), HEAP_AST);
         expr_unary->base.accept = ExprUnaryAccept;
         expr_unary->operator = operator;
         expr_unary->right = right;
@@ -1617,7 +2793,7 @@ Expr* factor(Parser *self){
     while (match(self, (TokenType[]){SLASH, STAR}, 2)){
         Token* operator = previous(self);
         Expr* right = unary(self);
-        ExprBinary* expr_binary = malloc(sizeof(ExprBinary));
+        ExprBinary* expr_binary = heapAllocate(sizeof(ExprBinary), HEAP_AST);
         expr_binary->base.accept = ExprBinaryAccept;
         expr_binary->left = expr;
         expr_binary->operator = operator;
@@ -1641,11 +2817,16 @@ Expr* finishCall(Parser* self, Expr* callee){
         } while (match(self, (TokenType[]){COMMA}, 1));
     }
     Token* paren = consume(self, RIGHT_PAREN, "Expect ')' after arguments.");
-    Call* expr_call = (Call*)malloc(sizeof(Call));
+    Call* expr_call = (Call*)heapAllocate(sizeof(Call), HEAP_AST);
     expr_call->base.accept = ExprCallAccept;
     expr_call->callee = callee;
     expr_call->paren = paren;
     expr_call->arguments = arguments;
+    expr_call->global_callee = 0;
+    expr_call->cache_version = 0;
+    expr_call->cached_callee = NIL_VAL;
+    expr_call->cached_declaration = NULL;
+    expr_call->cache_misses = 0;
     return (Expr*)expr_call;
 }
 
@@ -1656,7 +2837,7 @@ Expr* term(Parser* self){
     while (match(self, (TokenType[]){MINUS, PLUS}, 2)){
         Token* operator = previous(self);
         Expr* right = factor(self);
-        ExprBinary* expr_binary = malloc(sizeof(ExprBinary));
+        ExprBinary* expr_binary = heapAllocate(sizeof(ExprBinary), HEAP_AST);
         expr_binary->base.accept = ExprBinaryAccept;
         expr_binary->left = expr;
         expr_binary->operator = operator;
@@ -1671,7 +2852,7 @@ Expr* comparison(Parser* self){
     while(match(self, (TokenType[]){GREATER, GREATER_EQUAL, LESS, LESS_EQUAL}, 4)){
         Token* operator = previous(self);
         Expr* right = term(self);
-        ExprBinary* expr_binary = malloc(sizeof(ExprBinary));
+        ExprBinary* expr_binary = heapAllocate(sizeof(ExprBinary), HEAP_AST);
         expr_binary->base.accept = ExprBinaryAccept;
         expr_binary->left = expr;
         expr_binary->operator = operator;
@@ -1691,10 +2872,12 @@ Expr* assignment(Parser *self){
             Token* name = ((Variable*)expr)->name;
 
             // createAssignExpr(name, value);
-            Assign* expr_assign = (Assign*)malloc(sizeof(Assign));
+            Assign* expr_assign = (Assign*)heapAllocate(sizeof(Assign), HEAP_AST);
             expr_assign->base.accept = ExprAssignAccept;
             expr_assign->name = name;
             expr_assign->value = value;
+            expr_assign->slot = -1;
+            expr_assign->global_slot = -1;
             return (Expr*)expr_assign;
         }
         error(equals, "Invalid assignment target.");
@@ -1708,7 +2891,7 @@ Expr* equality(Parser *self){
     while (match(self, (TokenType[]){BANG_EQUAL, EQUAL_EQUAL}, 2)){
         Token* operator = previous(self);
         Expr* right = comparison(self);
-        ExprBinary* expr_binary= malloc(sizeof(ExprBinary));
+        ExprBinary* expr_binary= heapAllocate(sizeof(ExprBinary), HEAP_AST);
         expr_binary->base.accept = ExprBinaryAccept;
         expr_binary->left = expr;
         expr_binary->operator = operator;
@@ -1722,7 +2905,7 @@ Expr* or(Parser *self){
     while (match(self, (TokenType[]){OR}, 1)){
         Token* operator = previous(self);
         Expr* right = and(self);
-        Logical* logical_expr = (Logical*)malloc(sizeof(Logical));
+        Logical* logical_expr = (Logical*)heapAllocate(sizeof(Logical), HEAP_AST);
         logical_expr->base.accept = ExprLogicalAccept;
         logical_expr->left = expr;
         logical_expr->operator = operator;
@@ -1737,7 +2920,7 @@ Expr* and(Parser *self){
     while (match(self, (TokenType[]){AND}, 1)){
         Token* operator = previous(self);
         Expr* right = equality(self);
-        Logical* logical_expr = (Logical*)malloc(sizeof(Logical));
+        Logical* logical_expr = (Logical*)heapAllocate(sizeof(Logical), HEAP_AST);
         logical_expr->base.accept = ExprLogicalAccept;
         logical_expr->left = expr;
         logical_expr->operator = operator;
@@ -1767,10 +2950,11 @@ Stmt* varDeclaration(Parser* self){
     if (match(self, (TokenType[]){EQUAL}, 1)) {
         initializer = expression(self);
     } else {
-        ExprLiteral* expr = malloc(sizeof(ExprLiteral));
+        ExprLiteral* expr = heapAllocate(sizeof(ExprLiteral), HEAP_AST);
         expr->base.accept = ExprLiteralAccept;
         expr->type = NIL;
         expr->value = "nil";
+        expr->constant = literalConstant(expr->type, expr->value);
         initializer = (Expr*)expr;
     }
     consume(self, SEMICOLON, "Expect ';' after variable declaration.");
@@ -1894,10 +3078,11 @@ Stmt* forStatement(Parser *self){
     }
 
     if (condition == NULL){
-        ExprLiteral* expr_literal = (ExprLiteral*)malloc(sizeof(ExprLiteral));
+        ExprLiteral* expr_literal = (ExprLiteral*)heapAllocate(sizeof(ExprLiteral), HEAP_AST);
         expr_literal->base.accept = ExprLiteralAccept;
         expr_literal->type = TRUE;
         expr_literal->value = "true";
+        expr_literal->constant = literalConstant(expr_literal->type, expr_literal->value);
         condition = (Expr*)expr_literal;
     }
     body = (Stmt*)createWhileStmt(condition, body);
@@ -2107,7 +3292,7 @@ Token* consume(Parser* self, TokenType type, char* message){
 
 
 Parser* createParser() {
-    Parser* parser = (Parser*)malloc(sizeof(Parser));
+    Parser* parser = (Parser*)heapAllocate(sizeof(Parser), HEAP_AST);
     ParseError* parse_error = createParseError();
     if (parser) {
         parser->current = g_head_pointer->next;
@@ -2139,7 +3324,7 @@ Parser* createParser() {
 }
 
 ParseError* createParseError() {
-    ParseError* parse_error = (ParseError*)malloc(sizeof(ParseError));
+    ParseError* parse_error = (ParseError*)heapAllocate(sizeof(ParseError), HEAP_AST);
     if (parse_error){
         // TODO
     }
@@ -2147,13 +3332,10 @@ ParseError* createParseError() {
 }
 
 
-RuntimeError* createRuntimeError(Token token, char* message){
-    RuntimeError* runtime_error = (RuntimeError*)malloc(sizeof(RuntimeError));
-    if (runtime_error){
-        runtime_error->token = token;
-        runtime_error->message = message;
-    }
-    return runtime_error;
+void runtimeError(Token* token, char* message){
+    // 에러 값을 호출 스택 위로 전파하지 않고 그 자리에서 보고하고 종료한다
+    fprintf(stderr, "%s\n [line %d ]", message, token->line);
+    exit(70);
 }
 
 void* ExprBinaryAccept(Expr *self, Visitor *visitor){
@@ -2188,6 +3370,17 @@ void *ExprCallAccept(Expr* self, Visitor *visitor){
     visitor->visitCallExpr(visitor, self);
 }
 
+void* ExprCseDefAccept(Expr* self, Visitor *visitor){
+    return visitor->visitCseDefExpr(visitor, self);
+}
+
+void* ExprCseUseAccept(Expr* self, Visitor *visitor){
+    return visitor->visitCseUseExpr(visitor, self);
+}
+
+void* ExprNumberNegateAccept(Expr* self, Visitor *visitor){
+    return visitor->visitNumberNegateExpr(visitor, self);
+}
 
 void report(int line, char* where, char* message){
     // printf("[line %d] Error %s: %s\n", line, where, message);
@@ -2212,7 +3405,7 @@ char *parenthesize(const char *name, char **exprs, int count){
         if (exprs[i]) length += strlen(exprs[i]) +1; 
     }
 
-    char *result = malloc(length);
+    char *result = heapAllocate(length, HEAP_AST);
     strcpy(result, "(");
     strcat(result, name);
 
@@ -2230,8 +3423,8 @@ void *AstPrinterVisitBinaryExpr(Visitor *self, Expr *expr) {
     char *left = binaryExpr->left->accept(binaryExpr->left, self);
     char *right = binaryExpr->right->accept(binaryExpr->right, self);
     char *result = parenthesize(binaryExpr->operator->lexeme, (char *[]){left, right}, 2);
-    free(left);
-    free(right);
+    heapFree(left);
+    heapFree(right);
     return result;
 }
 
@@ -2239,7 +3432,7 @@ void *AstPrinterVisitUnaryExpr(Visitor *self, Expr *expr){
     ExprUnary *unaryExpr = (ExprUnary *)expr;
     char *right = unaryExpr->right->accept(unaryExpr->right, self);
     char *result = parenthesize(unaryExpr->operator->lexeme, (char *[]){right}, 1);
-    free(right);
+    heapFree(right);
     return result;
 }
 
@@ -2247,14 +3440,14 @@ void *AstPrinterVisitGroupingExpr(Visitor *self, Expr *expr){
     ExprGrouping *groupingExpr = (ExprGrouping *)expr;
     char *expression = groupingExpr->expression->accept(groupingExpr->expression, self);
     char *result = parenthesize("group", (char *[]){expression}, 1);
-    free(expression);
+    heapFree(expression);
     return result;
 }
 
 void *AstPrinterVisitLiteralExpr(Visitor *self, Expr *expr){
     ExprLiteral *literalExpr = (ExprLiteral *)expr;
-    if (!literalExpr -> value) return strdup("nil");
-    return strdup(literalExpr->value);
+    if (!literalExpr -> value) return heapStrdup("nil", HEAP_AST);
+    return heapStrdup(literalExpr->value, HEAP_AST);
 }
 
 char *print(Visitor *self, Expr *expr){
@@ -2262,7 +3455,7 @@ char *print(Visitor *self, Expr *expr){
 }
 
 AstPrinter *newAstPrinter(){
-    AstPrinter *printer = malloc(sizeof(AstPrinter));
+    AstPrinter *printer = heapAllocate(sizeof(AstPrinter), HEAP_AST);
     printer->base.visitBinaryExpr = AstPrinterVisitBinaryExpr;
     printer->base.visitUnaryExpr = AstPrinterVisitUnaryExpr;
     printer->base.visitGroupingExpr = AstPrinterVisitGroupingExpr;
@@ -2272,7 +3465,7 @@ AstPrinter *newAstPrinter(){
 }
 
 Interpreter *createInterpreter(){
-    Interpreter *interpreter = (Interpreter*)malloc(sizeof(Interpreter));
+    Interpreter *interpreter = (Interpreter*)heapAllocate(sizeof(Interpreter), HEAP_RUNTIME);
     interpreter->base.visitLiteralExpr = InterpreterVisitLiteralExpr;
     interpreter->base.visitGroupingExpr = InterpreterVisitGroupingExpr;
     interpreter->base.visitBinaryExpr = InterpreterVisitBinaryExpr;
@@ -2281,6 +3474,27 @@ Interpreter *createInterpreter(){
     interpreter->base.visitAssignExpr = InterpreterVisitAssignExpr;
     interpreter->base.visitLogicalExpr = InterpreterVisitLogicalExpr;
     interpreter->base.visitCallExpr = InterpreterVisitCallExpr;
+    interpreter->base.visitCseDefExpr = InterpreterVisitCseDefExpr;
+    interpreter->base.visitCseUseExpr = InterpreterVisitCseUseExpr;
+    interpreter->base.visitNumberAddExpr = InterpreterVisitNumberAddExpr;
+    interpreter->base.visitNumberSubtractExpr = InterpreterVisitNumberSubtractExpr;
+    interpreter->base.visitNumberMultiplyExpr = InterpreterVisitNumberMultiplyExpr;
+    interpreter->base.visitNumberDivideExpr = InterpreterVisitNumberDivideExpr;
+    interpreter->base.visitNumberGreaterExpr = InterpreterVisitNumberGreaterExpr;
+    interpreter->base.visitNumberGreaterEqualExpr = InterpreterVisitNumberGreaterEqualExpr;
+    interpreter->base.visitNumberLessExpr = InterpreterVisitNumberLessExpr;
+    interpreter->base.visitNumberLessEqualExpr = InterpreterVisitNumberLessEqualExpr;
+    interpreter->base.visitNumberEqualExpr = InterpreterVisitNumberEqualExpr;
+    interpreter->base.visitNumberNotEqualExpr = InterpreterVisitNumberNotEqualExpr;
+    interpreter->base.visitNumberNegateExpr = InterpreterVisitNumberNegateExpr;
+    interpreter->base.visitGuardedNumberAddExpr = InterpreterVisitGuardedNumberAddExpr;
+    interpreter->base.visitGuardedNumberSubtractExpr = InterpreterVisitGuardedNumberSubtractExpr;
+    interpreter->base.visitGuardedNumberMultiplyExpr = InterpreterVisitGuardedNumberMultiplyExpr;
+    interpreter->base.visitGuardedNumberDivideExpr = InterpreterVisitGuardedNumberDivideExpr;
+    interpreter->base.visitGuardedNumberGreaterExpr = InterpreterVisitGuardedNumberGreaterExpr;
+    interpreter->base.visitGuardedNumberGreaterEqualExpr = InterpreterVisitGuardedNumberGreaterEqualExpr;
+    interpreter->base.visitGuardedNumberLessExpr = InterpreterVisitGuardedNumberLessExpr;
+    interpreter->base.visitGuardedNumberLessEqualExpr = InterpreterVisitGuardedNumberLessEqualExpr;
     interpreter->stmt_visitor.visitExpressionStmt = InterpreterVisitExpressionStmt;
     interpreter->stmt_visitor.visitPrintStmt = InterpreterVisitPrintStmt;
     interpreter->stmt_visitor.visitVarStmt = InterpreterVisitVarStmt;
@@ -2289,12 +3503,23 @@ Interpreter *createInterpreter(){
     interpreter->stmt_visitor.visitWhileStmt = InterpreterVisitWhileStmt;
     interpreter->stmt_visitor.visitFunctionStmt = InterpreterVisitFunctionStmt;
     interpreter->stmt_visitor.visitReturnStmt = InterpreterVisitReturnStmt;
+    interpreter->cse_slot_count = 0;
+    interpreter->returning = 0;
+    interpreter->slots = NULL;
+    interpreter->call_depth = 0;
+    interpreter->function_depth = 0;
+    interpreter->tail_calling = 0;
+    interpreter->tail_callee = NIL_VAL;
+    interpreter->tail_arg_count = 0;
     interpreter->globals = createEnvironment();
     interpreter->environment = interpreter->globals;
+    interpreter->cse_slots = NULL;
+    interpreter->frames = createFrameStack();
 
     LoxFunction* native_clock_fun = createNativeFunction(nativeClockArity, nativeClockFunctionCall, nativeClockToString);
     Object* native_clock_fun_object = createObject(FUN, native_clock_fun);
-    define(interpreter->globals, "clock", native_clock_fun_object);
+    initGlobalTable();
+    define(interpreter->globals, internString("clock", 5), OBJ_VAL(native_clock_fun_object));
 
     interpreter->evaluate = evaluate;
     interpreter->execute = execute;
@@ -2305,17 +3530,17 @@ Interpreter *createInterpreter(){
 }
 
 Array* createArray(size_t initialCapacity) {
-    Array* array = (Array*)malloc(sizeof(Array));
+    Array* array = (Array*)heapAllocate(sizeof(Array), HEAP_AST);
     array->count = 0;
     array->capacity = initialCapacity;
-    array->elements = (Element*)malloc(sizeof(Element) * initialCapacity);
+    array->elements = (Element*)heapAllocate(sizeof(Element) * initialCapacity, HEAP_AST);
     return array;
 }
 
 void addElement(Array* array, Element element) {
     if (array->count >= array->capacity) {
         array->capacity *= 2;
-        array->elements = realloc(array->elements, sizeof(Element) * array->capacity);
+        array->elements = heapReallocate(array->elements, sizeof(Element) * array->capacity, HEAP_AST);
     }
     array->elements[array->count++] = element;
 }
@@ -2329,8 +3554,8 @@ void* getElement(Array* array, size_t index) {
 }
 
 void releaseArray(Array* array) {
-    free(array->elements);
-    free(array);
+    heapFree(array->elements);
+    heapFree(array);
 }
 
 void* PrintStmtAccept(Stmt *self, StmtVisitor *stmt_visitor){
@@ -2367,7 +3592,7 @@ void* ReturnStmtAccept(Stmt* self, StmtVisitor *stmt_visitor){
 
 
 Print* createPrintStmt(Expr* expr){
-    Print* print_stmt = (Print*)malloc(sizeof(Print));
+    Print* print_stmt = (Print*)heapAllocate(sizeof(Print), HEAP_AST);
     if (!print_stmt){
         fprintf(stderr, "Memory allocation failed\n");
         exit(EXIT_FAILURE);
@@ -2379,7 +3604,7 @@ Print* createPrintStmt(Expr* expr){
 }
 
 Expression* createExpressionStmt(Expr* expr){
-    Expression* expression_stmt = (Expression*)malloc(sizeof(Expression));
+    Expression* expression_stmt = (Expression*)heapAllocate(sizeof(Expression), HEAP_AST);
     if (!expression_stmt){
         fprintf(stderr, "Memory allocation failed\n");
         exit(EXIT_FAILURE);
@@ -2390,7 +3615,7 @@ Expression* createExpressionStmt(Expr* expr){
 }
 
 Var* createVarStmt(Token* name, Expr* expression){
-    Var* var_stmt = (Var*)malloc(sizeof(Var));
+    Var* var_stmt = (Var*)heapAllocate(sizeof(Var), HEAP_AST);
     if (!var_stmt){
         fprintf(stderr, "Memory allocation failed\n");
         exit(EXIT_FAILURE);        
@@ -2401,14 +3626,20 @@ Var* createVarStmt(Token* name, Expr* expression){
     return var_stmt;
 }
 Block* createBlockStmt(Array* statements){
-    Block* block = (Block*)malloc(sizeof(Block));
+    Block* block = (Block*)heapAllocate(sizeof(Block), HEAP_AST);
     block->base.accept = BlockStmtAccept;
     block->statements = statements;
+    block->escapes = 1;
+    block->declares = 0;
+    for (int i = 0; i < statements->count; i++){
+        ElementType type = ((Element*)getElement(statements, i))->type;
+        if (type == VAR_STMT || type == FUNCTION_STMT) block->declares = 1;
+    }
     return block;
 }
 
 If* createIfStmt(Expr* condition, Stmt* thenBranch, Stmt* elseBranch){
-    If* if_stmt = (If*)malloc(sizeof(If));
+    If* if_stmt = (If*)heapAllocate(sizeof(If), HEAP_AST);
     if_stmt->base.accept = IfStmtAccept;
     if_stmt->condition = condition;
     if_stmt->elseBranch = elseBranch;
@@ -2417,7 +3648,7 @@ If* createIfStmt(Expr* condition, Stmt* thenBranch, Stmt* elseBranch){
 }
 
 While* createWhileStmt(Expr* condition, Stmt* body){
-    While* while_stmt = (While*)malloc(sizeof(While));
+    While* while_stmt = (While*)heapAllocate(sizeof(While), HEAP_AST);
     while_stmt->base.accept = WhileStmtAccept;
     while_stmt->condition = condition;
     while_stmt->body = body;
@@ -2425,16 +3656,25 @@ While* createWhileStmt(Expr* condition, Stmt* body){
 }
 
 Function* createFunctionStmt(Token* name, Array* params, Array* body){
-    Function* function = (Function*)malloc(sizeof(Function));
+    Function* function = (Function*)heapAllocate(sizeof(Function), HEAP_AST);
     function->base.accept = FunctionStmtAccept;
     function->body = body;
     function->name = name;
     function->params = params;
+    function->memo = NULL;
+    function->chunk = NULL;
+    function->closure_code = NULL;
+    function->jit_code = NULL;
+    function->jit_hotness = 0;
+    function->jit_rejected = 0;
+    function->param_slots = 0;
+    function->body_declares = 1;
+    function->escapes = 1;
     return function;
 }
 
 Return* createReturnStmt(Token* keyword, Expr* value){
-    Return* return_stmt = (Return*)malloc(sizeof(Return));
+    Return* return_stmt = (Return*)heapAllocate(sizeof(Return), HEAP_AST);
     return_stmt->base.accept = ReturnStmtAccept;
     return_stmt->keyword = keyword;
     return_stmt->value = value;
@@ -2493,12 +3733,12 @@ void* InterpreterVisitExpressionStmt(StmtVisitor *self, Stmt* stmt){
     Expression* expr_stmt = (Expression*)stmt;
     size_t offset = offsetof(Interpreter, stmt_visitor);
 
-    Object* value = evaluate((Interpreter*)((char*)self - offset), expr_stmt->expression);
+    evaluate((Interpreter*)((char*)self - offset), expr_stmt->expression);
     return NULL;
 };
 
 void* InterpreterVisitVarStmt(StmtVisitor* self, Stmt* stmt){
-    Object* value = {NULL};
+    Value value = NIL_VAL;
     Expr* init = ((Var*)stmt)->initializer;
     size_t visitor_offset = offsetof(Interpreter, stmt_visitor);
     size_t env_offset = offsetof(Interpreter, environment);
@@ -2507,7 +3747,7 @@ void* InterpreterVisitVarStmt(StmtVisitor* self, Stmt* stmt){
     if (init){
         value = evaluate(interpreter, init);
     }
-    define(environment, ((Var*)stmt)->name->lexeme, value);
+    define(environment, ((Var*)stmt)->name->name, value);
 }
 
 
@@ -2515,8 +3755,8 @@ void* InterpreterVisitPrintStmt(StmtVisitor *self, Stmt* stmt){
     Print* print_stmt = (Print*)stmt;
 
     size_t offset = offsetof(Interpreter, stmt_visitor);
-    Object* value = evaluate((Interpreter*)((char*)self - offset), print_stmt->expression); 
-    printf("%s\n", stringify(*value));
+    Value value = evaluate((Interpreter*)((char*)self - offset), print_stmt->expression); 
+    printf("%s\n", stringify(value));
     return NULL;
 }
 
@@ -2526,8 +3766,18 @@ void* InterpreterVisitBlockStmt(StmtVisitor* self, Stmt* stmt){
 
     size_t offset = offsetof(Interpreter, stmt_visitor);
     Interpreter* interpreter = (Interpreter*)((char*)self - offset); 
-    Environment* env = createEnvironmentWithEnclosing(interpreter->environment);
+    if (!block_stmt->declares){
+        executeBlock(interpreter, statements, interpreter->environment);
+        return NULL;
+    }
+    if (block_stmt->escapes){
+        Environment* env = createEnvironmentWithEnclosing(interpreter->environment);
+        executeBlock(interpreter, statements, env);
+        return NULL;
+    }
+    Environment* env = pushFrameEnvironment(interpreter->frames, interpreter->environment);
     executeBlock(interpreter, statements, env);
+    popFrameEnvironment(interpreter->frames);
     return NULL;
 }
 
@@ -2549,7 +3799,10 @@ void* InterpreterVisitWhileStmt(StmtVisitor* self, Stmt* stmt){
     Interpreter* interpreter = (Interpreter*)((char*)self - visitor_offset);
 
     while (isTruthy(evaluate(interpreter, while_stmt->condition))){
+        // 반복문이 오래 도는 함수도 다음 호출부터 컴파일되도록 센다
+        if (jit_active_function) jit_active_function->jit_hotness++;
         execute(interpreter, while_stmt->body);
+        if (interpreter->returning) break;
     }
     return NULL;
 }
@@ -2561,7 +3814,7 @@ void* InterpreterVisitFunctionStmt(StmtVisitor* self, Stmt* stmt){
 
     LoxFunction* lox_function = createLoxFunction(function_stmt);
     Object* lox_function_object = createObject(FUN, lox_function);
-    define(interpreter->environment, function_stmt->name->lexeme, lox_function_object);
+    define(interpreter->environment, function_stmt->name->name, OBJ_VAL(lox_function_object));
     return NULL;
 }
 
@@ -2570,147 +3823,355 @@ void* InterpreterVisitReturnStmt(StmtVisitor* self, Stmt* stmt){
     size_t visitor_offset = offsetof(Interpreter, stmt_visitor);
     Interpreter* interpreter = (Interpreter*)((char*)self - visitor_offset);
 
-    Object* value = NULL;
-    if (return_stmt->value != NULL) value = evaluate(interpreter, return_stmt->value);
-
-    if (value){
-        global_return_value = value;
-        longjmp(jump_buffer, 1);
+    Value value = NIL_VAL;
+    if (interpreter->function_depth > 0 && isTailCall(return_stmt->value)){
+        value = returnTailCall(interpreter, (Call*)return_stmt->value);
+    } else if (return_stmt->value != NULL){
+        value = evaluate(interpreter, return_stmt->value);
     }
+
+    global_return_value = value;
+    interpreter->returning = 1;
     return NULL;
 }
 
+int isTailCall(Expr* value){
+    // 넘길 인자는 tail_arguments에 담기므로 그보다 많으면 보통 호출로 부르고 결과를 돌려준다
+    return value != NULL && value->accept == ExprCallAccept
+        && ((Call*)value)->arguments->count <= MAX_CALL_ARGUMENTS;
+}
+
+Value returnTailCall(Interpreter* interpreter, Call* call){
+    // 꼬리 위치의 호출은 함수와 인자만 넘기고 빠져나가서 functionCall이 지금 프레임 자리에서 이어서 실행하게 한다
+    size_t temp_count = gc.temp_count;
+    int arg_count = call->arguments->count;
+    Value callee;
+    LoxCallable* lox_callable;
+    Value* args = evaluateCall(interpreter, call, &callee, &lox_callable);
+    Value value = NIL_VAL;
+    if (((LoxFunction*)lox_callable)->declaration != NULL){
+        for (int i = 0; i < arg_count; i++) interpreter->tail_arguments[i] = args[i];
+        interpreter->tail_callee = callee;
+        interpreter->tail_arg_count = arg_count;
+        interpreter->tail_calling = 1;
+    } else {
+        value = lox_callable->call(lox_callable, interpreter, args, arg_count);
+    }
+    popSlots(arg_count);
+    gc.temp_count = temp_count;
+    return value;
+}
+
 
 Object* createObject(TokenType type,  void* value){
-    Object* object = (Object*)malloc(sizeof(Object));
+    if (type == STRING){
+        return internString((char*)value, strlen((char*)value));
+    }
+
+    Object* object = (Object*)slabAllocate(&function_object_pool);
     if (!object) {
         fprintf(stderr, "Memory allocation failed\n");
         exit(EXIT_FAILURE);
     }
-    if (type == NUMBER){
-        object->type = NUMBER;
-        NumberValue* num = (NumberValue*)malloc(sizeof(NumberValue));
-        num->number = strtod((char*)value, NULL); // 문자열 -> 숫자 변환
-        object->value = num;
+    if (type == FUN){
+        object->type = FUN;
+        object->value = value;
+        trackObject(object);
         return object;
     }
+}
 
-    // Boolean 타입 판별
-    if (type == TRUE){
-        object->type = TRUE;
-        BoolValue* boolVal = (BoolValue*)malloc(sizeof(BoolValue));
-        boolVal->boolean = 1;
-        object->value = boolVal;
-        return object;
-    }
-    if (type == FALSE){
-        object->type = FALSE;
-        BoolValue* boolVal = (BoolValue*)malloc(sizeof(BoolValue));
-        boolVal->boolean = 0;
-        object->value = boolVal;
-        return object;
+unsigned int hashString(const char* chars, size_t length){
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++){
+        hash ^= (unsigned char)chars[i];
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    // Nil 타입 판별
-    if (type == NIL){
-        object->type = NIL;
-        object->value = NULL;
-        return object;
+Object* internString(const char* chars, size_t length){
+    if ((intern_table.count + 1) * 4 > intern_table.capacity * 3) growInternTable();
+
+    unsigned int hash = hashString(chars, length);
+    size_t index = hash & (intern_table.capacity - 1);
+    size_t insert_index = intern_table.capacity;
+    while (intern_table.slots[index] != NULL){
+        Object* slot = intern_table.slots[index];
+        if (slot == INTERN_TOMBSTONE){
+            if (insert_index == intern_table.capacity) insert_index = index;
+        } else {
+            StringValue* string = (StringValue*)slot->value;
+            if (string->hash == hash && string->length == length && memcmp(string->string, chars, length) == 0){
+                return slot;
+            }
+        }
+        index = (index + 1) & (intern_table.capacity - 1);
     }
+    if (insert_index != intern_table.capacity) index = insert_index;
 
-    if (type == STRING){
-        object->type = STRING;
-        StringValue* str = (StringValue*)malloc(sizeof(StringValue));
-        str->string = strdup((char*)value); // 문자열 복사
-        object->value = str;
-        return object;
+    Object* object = (Object*)heapAllocate(sizeof(Object) + sizeof(StringValue) + length + 1, HEAP_STRINGS);
+    if (!object) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
     }
-    
-    if (type == FUN){
-        object->type = FUN;
-        object->value = value;
-        return object;
+    StringValue* string = (StringValue*)(object + 1);
+    string->length = length;
+    string->hash = hash;
+    memcpy(string->string, chars, length);
+    string->string[length] = '\0';
+    object->type = STRING;
+    object->value = string;
+    trackObject(object);
+
+    if (intern_table.slots[index] == NULL) intern_table.count++;
+    intern_table.slots[index] = object;
+    return object;
+}
+
+void growInternTable(){
+    Object** old_slots = intern_table.slots;
+    size_t old_capacity = intern_table.capacity;
+
+    intern_table.capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    intern_table.slots = (Object**)heapCallocate(intern_table.capacity, sizeof(Object*), HEAP_STRINGS);
+    intern_table.count = 0;
+    for (size_t i = 0; i < old_capacity; i++){
+        Object* object = old_slots[i];
+        if (object == NULL || object == INTERN_TOMBSTONE) continue;
+        size_t index = ((StringValue*)object->value)->hash & (intern_table.capacity - 1);
+        while (intern_table.slots[index] != NULL){
+            index = (index + 1) & (intern_table.capacity - 1);
+        }
+        intern_table.slots[index] = object;
+        intern_table.count++;
     }
+    heapFree(old_slots);
 }
 
-unsigned int hash(char* key) {
-    unsigned int hash = 0;
-    while (*key) {
-        hash = (hash * 31) + *key++;
+Object* createRope(Object* left, Object* right){
+    Object* object = (Object*)allocateYoung(sizeof(Object) + sizeof(RopeValue));
+    int young = object != NULL;
+    if (!young){
+        // 힙 객체가 nursery를 가리키면 nursery를 비울 때 끊어지므로 자식도 승격한다
+        left = promoteObject(left);
+        right = promoteObject(right);
+        object = (Object*)slabAllocate(&rope_pool);
+    }
+    if (!object) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    RopeValue* rope = (RopeValue*)(object + 1);
+    rope->length = stringLength(left) + stringLength(right);
+    rope->left = left;
+    rope->right = right;
+    rope->flat = NULL;
+    object->type = ROPE;
+    object->value = rope;
+    if (young){
+        object->mark_epoch = 0;
+        object->next = NULL; // 승격되면 힙 사본을 가리킨다
+    } else {
+        trackObject(object);
     }
-    return hash % TABLE_SIZE;
+    return object;
 }
 
-void insert(Entry* hashTable[], char* key, Object* value) {
-    unsigned int idx = hash(key);
-    Entry* entry = hashTable[idx];
+size_t stringLength(Object* object){
+    if (object->type == ROPE) return ((RopeValue*)object->value)->length;
+    return ((StringValue*)object->value)->length;
+}
 
-    while (entry != NULL) {
-        if (strcmp(entry->key, key) == 0) {
-            entry->value = value;
-            return;
+Object* flattenRope(Object* object){
+    RopeValue* rope = (RopeValue*)object->value;
+    if (rope->flat) return rope->flat;
+
+    char* buffer = (char*)heapAllocate(rope->length + 1, HEAP_STRINGS);
+    size_t position = 0;
+
+    // s = s + piece 로 만든 로프는 한쪽으로 깊으므로 재귀 대신 명시적 스택으로 순회한다
+    size_t stack_capacity = 64;
+    size_t stack_count = 0;
+    Object** stack = (Object**)heapAllocate(sizeof(Object*) * stack_capacity, HEAP_STRINGS);
+    stack[stack_count++] = object;
+    while (stack_count > 0){
+        Object* node = stack[--stack_count];
+        if (node->type == ROPE && ((RopeValue*)node->value)->flat){
+            node = ((RopeValue*)node->value)->flat;
         }
-        entry = entry->next;
+        if (node->type == STRING){
+            StringValue* string = (StringValue*)node->value;
+            memcpy(buffer + position, string->string, string->length);
+            position += string->length;
+            continue;
+        }
+        if (stack_count + 2 > stack_capacity){
+            stack_capacity *= 2;
+            stack = (Object**)heapReallocate(stack, sizeof(Object*) * stack_capacity, HEAP_STRINGS);
+        }
+        stack[stack_count++] = ((RopeValue*)node->value)->right;
+        stack[stack_count++] = ((RopeValue*)node->value)->left;
     }
+    heapFree(stack);
 
-    // 새로운 항목 추가
-    Entry* newEntry = (Entry*)malloc(sizeof(Entry));
-    strcpy(newEntry->key, key);
-    newEntry->value = value;
-    newEntry->next = hashTable[idx];
-    hashTable[idx] = newEntry;
+    rope->flat = internString(buffer, rope->length);
+    rope->left = NULL;
+    rope->right = NULL;
+    heapFree(buffer);
+    return rope->flat;
 }
 
+Value flattenValue(Value value){
+    if (IS_ROPE(value)) return OBJ_VAL(flattenRope(AS_OBJ(value)));
+    return value;
+}
 
-Object* find(Entry* hashTable[], char* key) {
-    unsigned int idx = hash(key);
-    Entry* entry = hashTable[idx];
+void initHashTable(HashTable* table){
+    table->entries = table->inline_entries;
+    table->capacity = HASH_INLINE_CAPACITY;
+    table->count = 0;
+    for (int i = 0; i < HASH_INLINE_CAPACITY; i++) {
+        table->inline_entries[i].key = NULL;
+    }
+}
 
-    while (entry != NULL) {
-        if (strcmp(entry->key, key) == 0) {
-            return entry->value;
-        }
-        entry = entry->next;
+Entry* findEntry(HashTable* table, Object* key){
+    unsigned int mask = table->capacity - 1;
+    unsigned int index = ((StringValue*)key->value)->hash & mask;
+    while (1) {
+        Entry* entry = &table->entries[index];
+        if (entry->key == key || entry->key == NULL) return entry;
+        index = (index + 1) & mask;
     }
-    return NULL;
 }
 
-void releaseHashTable(Entry* hashTable[]) {
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        Entry* entry = hashTable[i];
-        while (entry != NULL) {
-            Entry* temp = entry;
-            entry = entry->next;
-            
-            if (temp->value) {
-                if (temp->value->type == STRING) {
-                    free(((StringValue*)temp->value->value)->string);
-                    free(temp->value->value);
-                } else if (temp->value->type == NUMBER) {
-                    free(temp->value->value);
-                } else if (temp->value->type == TRUE || temp->value->type == FALSE) {
-                    free(temp->value->value);
-                }
-                free(temp->value);
-            }
-            free(temp);
+void insert(HashTable* table, Object* key, Value value) {
+    value = promoteValue(value);
+    Entry* entry = findEntry(table, key);
+    if (entry->key != NULL) {
+        entry->value = value;
+        return;
+    }
+
+    // 새로운 항목 추가
+    if ((table->count + 1) * 4 > table->capacity * 3) {
+        growHashTable(table);
+        entry = findEntry(table, key);
+    }
+    entry->key = key;
+    entry->hash = ((StringValue*)key->value)->hash;
+    entry->value = value;
+    table->count++;
+}
+
+int find(HashTable* table, Object* key, Value* value) {
+    Entry* entry = findEntry(table, key);
+    if (entry->key == NULL) return 0;
+    *value = entry->value;
+    return 1;
+}
+
+void growHashTable(HashTable* table){
+    Entry* old_entries = table->entries;
+    unsigned int old_capacity = table->capacity;
+
+    table->capacity = old_capacity * 2;
+    table->entries = (Entry*)heapCallocate(table->capacity, sizeof(Entry), HEAP_ENVIRONMENTS);
+    if (!table->entries) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    unsigned int mask = table->capacity - 1;
+    for (unsigned int i = 0; i < old_capacity; i++){
+        Entry* entry = &old_entries[i];
+        if (entry->key == NULL) continue;
+        unsigned int index = entry->hash & mask;
+        while (table->entries[index].key != NULL){
+            index = (index + 1) & mask;
         }
-        hashTable[i] = NULL;
+        table->entries[index] = *entry;
     }
+    if (old_entries != table->inline_entries) heapFree(old_entries);
+}
+
+void releaseHashTable(HashTable* table) {
+    // 값은 다른 환경과 공유될 수 있으므로 테이블만 해제한다
+    if (table->entries != table->inline_entries) heapFree(table->entries);
+    initHashTable(table);
 }
 
 Environment* createEnvironment(){
-    Environment* env = (Environment*)malloc(sizeof(Environment));
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        env->values[i] = NULL; // 초기화
-    }    
+    Environment* env = (Environment*)slabAllocate(&environment_pool);
+    initEnvironment(env, NULL);
+    trackEnvironment(env);
+    return env;
+}
+
+void initEnvironment(Environment* env, Environment* enclosing){
+    initHashTable(&env->values);
     env->define = define;
     env->assign = assign;
     env->get = get;
-    env->enclosing = NULL;
+    env->enclosing = enclosing;
+    env->mark_epoch = 0;
+    env->gc_next = NULL;
+}
+
+void releaseEnvironmentEntries(Environment* env){
+    // 값은 다른 환경이나 반환값과 공유될 수 있으므로 테이블만 해제한다
+    releaseHashTable(&env->values);
+}
+
+FrameStack* createFrameStack(){
+    FrameStack* stack = (FrameStack*)heapAllocate(sizeof(FrameStack), HEAP_ENVIRONMENTS);
+    stack->chunk = (FrameChunk*)heapAllocate(sizeof(FrameChunk), HEAP_ENVIRONMENTS);
+    stack->chunk->prev = NULL;
+    stack->chunk->next = NULL;
+    stack->top = 0;
+    return stack;
+}
+
+Environment* pushFrameEnvironment(FrameStack* stack, Environment* enclosing){
+    if (stack->top == FRAME_CHUNK_SIZE){
+        if (stack->chunk->next == NULL){
+            FrameChunk* chunk = (FrameChunk*)heapAllocate(sizeof(FrameChunk), HEAP_ENVIRONMENTS);
+            chunk->prev = stack->chunk;
+            chunk->next = NULL;
+            stack->chunk->next = chunk;
+        }
+        stack->chunk = stack->chunk->next;
+        stack->top = 0;
+    }
+    Environment* env = &stack->chunk->frames[stack->top++];
+    initEnvironment(env, enclosing);
     return env;
 }
 
+void popFrameEnvironment(FrameStack* stack){
+    stack->top--;
+    releaseEnvironmentEntries(&stack->chunk->frames[stack->top]);
+    // 청크 경계에서도 위치 표현이 하나뿐이어야 markFrameStack과 비교할 수 있다
+    if (stack->top == 0 && stack->chunk->prev != NULL){
+        stack->chunk = stack->chunk->prev;
+        stack->top = FRAME_CHUNK_SIZE;
+    }
+}
+
+FrameMark markFrameStack(FrameStack* stack){
+    FrameMark mark;
+    mark.chunk = stack->chunk;
+    mark.top = stack->top;
+    return mark;
+}
+
+void unwindFrameStack(FrameStack* stack, FrameMark mark){
+    // return으로 빠져나간 블록들의 프레임을 한 번에 회수한다
+    while (stack->chunk != mark.chunk || stack->top != mark.top){
+        popFrameEnvironment(stack);
+    }
+}
+
 Environment* createEnvironmentWithEnclosing(Environment* enclosing){
     Environment* env = createEnvironment();
     env->enclosing = enclosing;
@@ -2718,53 +4179,99 @@ Environment* createEnvironmentWithEnclosing(Environment* enclosing){
 }
 
 
-void* define(Environment* self, char* name, Object* value){
-    insert(self->values, name, value);
+void* define(Environment* self, Object* name, Value value){
+    if (self->enclosing == NULL){
+        defineGlobal(globalSlot(name), value);
+        return NULL;
+    }
+    insert(&self->values, name, value);
+    return NULL;
 }
 
-Object* get(Environment* self, Token* name){
-
-    Object* object = find(self->values, name->lexeme);
-    if (object) return object;
-
+Value get(Environment* self, Token* name){
+    Value value;
     while (self->enclosing != NULL){
-        Object* object = find(self->enclosing->values, name->lexeme);
-        if (object) return object;
+        if (find(&self->values, name->name, &value)) return value;
         self = self->enclosing;
     }
+    return getGlobal(globalSlot(name->name), name);
+}
 
-    runtime_error_flag = 1;
-    char buffer[MAX_TOKEN_LEXEME_SIZE + 30] = "Undefined variable '"; 
-    strcat(buffer, name->lexeme);
-    strcat(buffer, "'.");
-    createRuntimeError(*name, buffer);
-}
-
-void* assign(Environment* self, Token* name, Object* value){
-    if (find(self->values, name->lexeme)){
-        insert(self->values, name->lexeme, value);
-        return NULL;
-    }
+void* assign(Environment* self, Token* name, Value value){
     while (self->enclosing != NULL){
-        Object* object = find(self->enclosing->values, name->lexeme);
-        if (object) {
-            insert(self->enclosing->values, name->lexeme, value);
+        Entry* entry = findEntry(&self->values, name->name);
+        if (entry->key != NULL) {
+            entry->value = promoteValue(value);
             return NULL;
         }
         self = self->enclosing;
     }
+    setGlobal(globalSlot(name->name), name, value);
+    return NULL;
+}
+
+void initGlobalTable(){
+    initHashTable(&global_table.ids);
+    global_table.values = NULL;
+    global_table.names = NULL;
+    global_table.count = 0;
+    global_table.capacity = 0;
+}
+
+int globalSlot(Object* name){
+    Value id;
+    if (find(&global_table.ids, name, &id)) return (int)AS_NUMBER(id);
+
+    if (global_table.count == global_table.capacity){
+        int capacity = global_table.capacity < 8 ? 8 : global_table.capacity * 2;
+        global_table.values = (Value*)heapReallocate(global_table.values, capacity * sizeof(Value), HEAP_VALUES);
+        global_table.names = (Object**)heapReallocate(global_table.names, capacity * sizeof(Object*), HEAP_RUNTIME);
+        global_table.capacity = capacity;
+    }
+    int slot = global_table.count++;
+    global_table.values[slot] = UNDEFINED_VAL;
+    global_table.names[slot] = name;
+    insert(&global_table.ids, name, NUMBER_VAL(slot));
+    return slot;
+}
+
+void defineGlobal(int slot, Value value){
+    global_table.values[slot] = promoteValue(value);
+    globals_version++;
+}
 
+void undefinedVariable(Token* name){
     char buffer[MAX_TOKEN_LEXEME_SIZE + 30] = "Undefined variable '"; 
     strcat(buffer, name->lexeme);
     strcat(buffer, "'.");
-    runtime_error_flag = 1;
-    createRuntimeError(*name, buffer);
+    runtimeError(name, buffer);
+}
+
+Value getGlobal(int slot, Token* name){
+    Value value = global_table.values[slot];
+    if (value == UNDEFINED_VAL) undefinedVariable(name);
+    return value;
+}
+
+void setGlobal(int slot, Token* name, Value value){
+    Value old = global_table.values[slot];
+    if (old == UNDEFINED_VAL) undefinedVariable(name);
+    // 호출 위치가 기억하는 함수가 바뀔 수 있는 경우에만 버전을 올린다
+    if (IS_FUNCTION(old) || IS_FUNCTION(value)) globals_version++;
+    global_table.values[slot] = promoteValue(value);
+}
+
+void markGlobalTable(){
+    for (int i = 0; i < global_table.count; i++){
+        markObject(global_table.names[i]);
+        markValue(global_table.values[i]);
+    }
 }
 
 LoxFunction* createNativeFunction(int (*arity)(LoxCallable* self),
-                                Object* (*function_call)(void* self, Interpreter* interpreter, Array* arguments),
+                                Value (*function_call)(void* self, Interpreter* interpreter, Value* arguments, int arg_count),
                                 char* (*to_string)(LoxFunction* self)){
-    LoxFunction* lox_function = (LoxFunction*)malloc(sizeof(LoxFunction));
+    LoxFunction* lox_function = (LoxFunction*)slabAllocate(&lox_function_pool);
     lox_function->base.call = function_call;
     lox_function->base.arity = arity;
     lox_function->toString = to_string;
@@ -2773,8 +4280,9 @@ LoxFunction* createNativeFunction(int (*arity)(LoxCallable* self),
 }
 
 LoxFunction* createLoxFunction(Function* declaration){
-    LoxFunction* lox_function = (LoxFunction*)malloc(sizeof(LoxFunction));
-    lox_function->base.call = functionCall;
+    LoxFunction* lox_function = (LoxFunction*)slabAllocate(&lox_function_pool);
+    // 메모할 함수는 functionCall을 거치지 않고 바로 들어가서 재귀마다 C 스택 프레임 하나를 아낀다
+    lox_function->base.call = memoActive(declaration->memo) ? memoizedCall : functionCall;
     lox_function->base.arity = arity;
     lox_function->toString = toString;
     lox_function->declaration = declaration;
@@ -2782,25 +4290,129 @@ LoxFunction* createLoxFunction(Function* declaration){
 }
 
 
-Object* functionCall(void* self, Interpreter* interpreter, Array* arguments){
-    LoxFunction* lox_function = (LoxFunction*)self;
-    Function* fun_decl = lox_function->declaration;
-    Environment* environment = createEnvironmentWithEnclosing(interpreter->globals);
-    for (int i = 0; i < fun_decl->params->count; i++){
-        Element* param_elem = getElement(fun_decl->params, i);
-        Token* param_token = param_elem->data.token;
+Value functionCall(void* self, Interpreter* interpreter, Value* arguments, int arg_count){
+    // 재귀할 때마다 C 스택에 남는 프레임이므로 메모와 꼬리 호출은 따로 빼서 이 함수를 작게 둔다
+    Function* fun_decl = ((LoxFunction*)self)->declaration;
+    if (memoActive(fun_decl->memo)) return memoizedCall(self, interpreter, arguments, arg_count);
+    Value result = runFunctionBody(interpreter, fun_decl, arguments, arg_count);
+    if (interpreter->tail_calling) result = runTailCalls(interpreter, arguments, arg_count, 0);
+    return result;
+}
+
+Value memoizedCall(void* self, Interpreter* interpreter, Value* arguments, int arg_count){
+    Function* fun_decl = ((LoxFunction*)self)->declaration;
+    if (!memoActive(fun_decl->memo) || !isMemoizableArguments(arguments, arg_count)){
+        Value result = runFunctionBody(interpreter, fun_decl, arguments, arg_count);
+        if (interpreter->tail_calling) result = runTailCalls(interpreter, arguments, arg_count, 0);
+        return result;
+    }
+    MemoTable* memo = fun_decl->memo;
+    unsigned int memo_hash = memoHash(arguments, arg_count);
+    MemoEntry* entry = memoLookup(memo, arguments, memo_hash);
+    if (entry){
+        memo->hits++;
+        return entry->result;
+    }
+    memoRecordMiss(memo);
+
+    // 본문이 인자 슬롯에 대입하거나 꼬리 호출이 덮어써도 저장할 키가 남도록 인자를 따로 옮긴다
+    Value* frame = pushSlots(arg_count);
+    for (int i = 0; i < arg_count; i++) frame[i] = arguments[i];
+    Value result = runFunctionBody(interpreter, fun_decl, frame, arg_count);
+    if (interpreter->tail_calling){
+        result = runTailCalls(interpreter, frame, arg_count, arg_count);
+    } else {
+        popSlots(arg_count);
+    }
+    // 본문을 도는 사이에 재귀 호출이 메모를 껐을 수 있다
+    if (!memo->disabled) memoStore(memo, arguments, memo_hash, result);
+    return result;
+}
+
+Value runTailCalls(Interpreter* interpreter, Value* arguments, int arg_count, int owned_slots){
+    // 꼬리 호출은 C 스택과 값 스택을 더 쌓지 않고 지금 프레임 자리에서 다음 함수를 실행한다.
+    // owned_slots가 0이면 arguments는 호출한 쪽의 자리이고, 아니면 여기서 거둬야 할 값 스택의 자리다
+    size_t temp_count = gc.temp_count;
+    Value* frame = arguments;
+    Value result = NIL_VAL;
+    while (interpreter->tail_calling){
+        interpreter->tail_calling = 0;
+        Value callee = interpreter->tail_callee;
+        int next_count = interpreter->tail_arg_count;
+        gc.temp_count = temp_count;
+        pushTempRoot(callee);
+        if (owned_slots == 0 && next_count <= arg_count){
+            frame = arguments;
+        } else {
+            if (owned_slots) popSlots(owned_slots);
+            frame = pushSlots(next_count);
+            owned_slots = next_count;
+        }
+        for (int i = 0; i < next_count; i++) frame[i] = interpreter->tail_arguments[i];
+        Function* next = ((LoxFunction*)AS_OBJ(callee)->value)->declaration;
+        if (memoActive(next->memo) && isMemoizableArguments(frame, next_count)){
+            // 이어서 실행하는 함수의 결과는 저장하지 않고 이미 있는 것만 찾아 쓴다. 저장하려면 C 스택에 돌아올 자리가 있어야 한다
+            MemoEntry* entry = memoLookup(next->memo, frame, memoHash(frame, next_count));
+            if (entry){
+                next->memo->hits++;
+                result = entry->result;
+                break;
+            }
+            memoRecordMiss(next->memo);
+        }
+        result = runFunctionBody(interpreter, next, frame, next_count);
+    }
+    gc.temp_count = temp_count;
+    if (owned_slots) popSlots(owned_slots);
+    return result;
+}
 
-        Element* arg_elem = getElement(arguments, i);
-        Object* arg_object = arg_elem->data.object;
-        define(environment, param_token->lexeme, arg_object);
+Value runFunctionBody(Interpreter* interpreter, Function* fun_decl, Value* arguments, int arg_count){
+    if (fun_decl->jit_code == NULL && jit.enabled && !fun_decl->jit_rejected && !memoActive(fun_decl->memo)
+        && ++fun_decl->jit_hotness >= jit.threshold){
+        fun_decl->jit_code = jitCompile(fun_decl);
+    }
+    if (fun_decl->jit_code){
+        Value* slots = pushJitFrame(fun_decl->jit_code, arg_count);
+        for (int i = 0; i < arg_count; i++) slots[i] = arguments[i];
+        return runJitCode(fun_decl->jit_code, slots);
     }
 
-    if (setjmp(jump_buffer) == 0) {
-        executeBlock(interpreter, fun_decl->body, environment);
+    FrameMark frame_mark = markFrameStack(interpreter->frames);
+    Environment* environment;
+    if (fun_decl->param_slots && !fun_decl->body_declares){
+        // 인자는 슬롯에 있고 본문이 선언하는 이름도 없으면 호출마다 환경을 만들 필요가 없다
+        environment = interpreter->globals;
+    } else if (fun_decl->escapes){
+        environment = createEnvironmentWithEnclosing(interpreter->globals);
     } else {
-        return global_return_value;
+        environment = pushFrameEnvironment(interpreter->frames, interpreter->globals);
     }
-    return NULL;
+    if (!fun_decl->param_slots){
+        for (int i = 0; i < fun_decl->params->count; i++){
+            Element* param_elem = getElement(fun_decl->params, i);
+            define(environment, param_elem->data.token->name, arguments[i]);
+        }
+    }
+
+    // 인자는 호출한 쪽이 값 스택에 바로 평가해 둔 자리를 그대로 프레임으로 쓴다
+    Value* previous_slots = interpreter->slots;
+    interpreter->slots = arguments;
+    Function* outer_function = jit_active_function;
+    jit_active_function = fun_decl;
+    Value result = NIL_VAL;
+    // return은 블록과 반복문을 정상적으로 빠져나오며 전달되므로 환경과 루트도 각자 되돌린다
+    interpreter->function_depth++;
+    executeBlock(interpreter, fun_decl->body, environment);
+    interpreter->function_depth--;
+    if (interpreter->returning){
+        result = global_return_value;
+        interpreter->returning = 0;
+    }
+    jit_active_function = outer_function;
+    interpreter->slots = previous_slots;
+    unwindFrameStack(interpreter->frames, frame_mark);
+    return result;
 }
 
 int arity(LoxCallable* self){
@@ -2808,13 +4420,8 @@ int arity(LoxCallable* self){
 }
 
 char* toString(LoxFunction* self) {
-    char* buffer = (char*)malloc(MAX_TOKEN_LEXEME_SIZE + 20); 
-    if (buffer == NULL) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(EXIT_FAILURE);
-    }
-
-    snprintf(buffer, MAX_TOKEN_LEXEME_SIZE + 20, "<fn %s>", self->declaration->name->lexeme);
+    static char buffer[MAX_TOKEN_LEXEME_SIZE + 20];
+    snprintf(buffer, sizeof(buffer), "<fn %s>", self->declaration->name->lexeme);
 
     return buffer;
 }
@@ -2823,14 +4430,3634 @@ char* toString(LoxFunction* self) {
 int nativeClockArity(LoxCallable* self){
     return 0;
 }
-Object* nativeClockFunctionCall(void* self, Interpreter* interpreter, Array* arguments){
-    time_t now = time(NULL);
-
-    char* buffer = (char*)malloc(sizeof(32));
-    snprintf(buffer, 32, "%.ld", now);
-    
-    return createObject(NUMBER, buffer);
+Value nativeClockFunctionCall(void* self, Interpreter* interpreter, Value* arguments, int arg_count){
+    // 벤치마크가 clock() 차이로 시간을 재므로 초 단위 아래까지 돌려준다
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return NUMBER_VAL((double)now.tv_sec + (double)now.tv_nsec / 1e9);
 }
 char* nativeClockToString(LoxFunction* self){
     return "<native fn>";
-}
\ No newline at end of file
+}
+CseTable* createCseTable(){
+    CseTable* table = (CseTable*)heapAllocate(sizeof(CseTable), HEAP_RUNTIME);
+    table->capacity = INITIAL_LIST_SIZE;
+    table->entries = (CseEntry*)heapAllocate(sizeof(CseEntry) * table->capacity, HEAP_RUNTIME);
+    table->count = 0;
+    table->floor = 0;
+    table->slot_count = 0;
+    return table;
+}
+
+void releaseCseTable(CseTable* table){
+    heapFree(table->entries);
+    heapFree(table);
+}
+
+Expr* unwrapCseExpr(Expr* expr){
+    while (1){
+        if (expr->accept == ExprGroupingAccept){
+            expr = ((ExprGrouping*)expr)->expression;
+        } else if (expr->accept == ExprCseDefAccept){
+            expr = ((CseDef*)expr)->expression;
+        } else if (expr->accept == ExprCseUseAccept){
+            expr = ((CseUse*)expr)->def->expression;
+        } else {
+            return expr;
+        }
+    }
+}
+
+int isPureExpr(Expr* expr){
+    expr = unwrapCseExpr(expr);
+    if (expr->accept == ExprLiteralAccept || expr->accept == ExprVariableAccept) return 1;
+    if (expr->accept == ExprUnaryAccept) return isPureExpr(((ExprUnary*)expr)->right);
+    if (expr->accept == ExprBinaryAccept){
+        return isPureExpr(((ExprBinary*)expr)->left) && isPureExpr(((ExprBinary*)expr)->right);
+    }
+    if (expr->accept == ExprLogicalAccept){
+        return isPureExpr(((Logical*)expr)->left) && isPureExpr(((Logical*)expr)->right);
+    }
+    // Assign, Call
+    return 0;
+}
+
+int isCseCandidate(Expr* expr){
+    // 리터럴과 변수는 다시 평가하는 것이 임시 슬롯보다 싸다
+    if (expr->accept != ExprBinaryAccept && expr->accept != ExprUnaryAccept && expr->accept != ExprLogicalAccept){
+        return 0;
+    }
+    return isPureExpr(expr);
+}
+
+unsigned int cseStringHash(char* key){
+    unsigned int hash = 0;
+    while (*key) {
+        hash = (hash * 31) + *key++;
+    }
+    return hash;
+}
+
+unsigned int cseHash(Expr* expr){
+    expr = unwrapCseExpr(expr);
+    if (expr->accept == ExprLiteralAccept){
+        ExprLiteral* literal = (ExprLiteral*)expr;
+        return cseStringHash(literal->value) * 31 + literal->type;
+    }
+    if (expr->accept == ExprVariableAccept){
+        return cseStringHash(((Variable*)expr)->name->lexeme) * 17 + 1;
+    }
+    if (expr->accept == ExprUnaryAccept){
+        ExprUnary* unary = (ExprUnary*)expr;
+        return cseHash(unary->right) * 31 + unary->operator->type;
+    }
+    if (expr->accept == ExprBinaryAccept){
+        ExprBinary* binary = (ExprBinary*)expr;
+        return (cseHash(binary->left) * 31 + binary->operator->type) * 31 + cseHash(binary->right);
+    }
+    if (expr->accept == ExprLogicalAccept){
+        Logical* logical = (Logical*)expr;
+        return (cseHash(logical->left) * 37 + logical->operator->type) * 37 + cseHash(logical->right);
+    }
+    return 0;
+}
+
+int cseEqual(Expr* a, Expr* b){
+    a = unwrapCseExpr(a);
+    b = unwrapCseExpr(b);
+    if (a == b) return 1;
+    if (a->accept != b->accept) return 0;
+
+    if (a->accept == ExprLiteralAccept){
+        ExprLiteral* left = (ExprLiteral*)a;
+        ExprLiteral* right = (ExprLiteral*)b;
+        return left->type == right->type && strcmp(left->value, right->value) == 0;
+    }
+    if (a->accept == ExprVariableAccept){
+        return strcmp(((Variable*)a)->name->lexeme, ((Variable*)b)->name->lexeme) == 0;
+    }
+    if (a->accept == ExprUnaryAccept){
+        ExprUnary* left = (ExprUnary*)a;
+        ExprUnary* right = (ExprUnary*)b;
+        return left->operator->type == right->operator->type && cseEqual(left->right, right->right);
+    }
+    if (a->accept == ExprBinaryAccept){
+        ExprBinary* left = (ExprBinary*)a;
+        ExprBinary* right = (ExprBinary*)b;
+        return left->operator->type == right->operator->type
+            && cseEqual(left->left, right->left) && cseEqual(left->right, right->right);
+    }
+    if (a->accept == ExprLogicalAccept){
+        Logical* left = (Logical*)a;
+        Logical* right = (Logical*)b;
+        return left->operator->type == right->operator->type
+            && cseEqual(left->left, right->left) && cseEqual(left->right, right->right);
+    }
+    return 0;
+}
+
+int cseMentions(Expr* expr, char* name){
+    expr = unwrapCseExpr(expr);
+    if (expr->accept == ExprVariableAccept){
+        return strcmp(((Variable*)expr)->name->lexeme, name) == 0;
+    }
+    if (expr->accept == ExprUnaryAccept) return cseMentions(((ExprUnary*)expr)->right, name);
+    if (expr->accept == ExprBinaryAccept){
+        return cseMentions(((ExprBinary*)expr)->left, name) || cseMentions(((ExprBinary*)expr)->right, name);
+    }
+    if (expr->accept == ExprLogicalAccept){
+        return cseMentions(((Logical*)expr)->left, name) || cseMentions(((Logical*)expr)->right, name);
+    }
+    return 0;
+}
+
+CseEntry* cseLookup(CseTable* table, unsigned int hash, Expr* expr){
+    for (size_t i = table->count; i > table->floor; i--){
+        CseEntry* entry = &table->entries[i - 1];
+        if (entry->killed || entry->hash != hash) continue;
+        if (cseEqual(entry->expression, expr)) return entry;
+    }
+    return NULL;
+}
+
+void cseRegister(CseTable* table, unsigned int hash, Expr** site){
+    if (table->count >= table->capacity){
+        table->capacity *= 2;
+        table->entries = heapReallocate(table->entries, sizeof(CseEntry) * table->capacity, HEAP_RUNTIME);
+    }
+    CseEntry* entry = &table->entries[table->count++];
+    entry->hash = hash;
+    entry->expression = *site;
+    entry->site = site;
+    entry->def = NULL;
+    entry->killed = 0;
+}
+
+Expr* createCseUse(CseTable* table, CseEntry* entry){
+    if (entry->def == NULL){
+        CseDef* cse_def = (CseDef*)heapAllocate(sizeof(CseDef), HEAP_AST);
+        cse_def->base.accept = ExprCseDefAccept;
+        cse_def->expression = *entry->site;
+        cse_def->slot = table->slot_count++;
+        *entry->site = (Expr*)cse_def;
+        entry->def = cse_def;
+    }
+    CseUse* cse_use = (CseUse*)heapAllocate(sizeof(CseUse), HEAP_AST);
+    cse_use->base.accept = ExprCseUseAccept;
+    cse_use->def = entry->def;
+    cse_use->slot = entry->def->slot;
+    return (Expr*)cse_use;
+}
+
+void cseKillAll(CseTable* table){
+    for (size_t i = table->floor; i < table->count; i++){
+        table->entries[i].killed = 1;
+    }
+}
+
+void cseKillName(CseTable* table, char* name){
+    for (size_t i = table->floor; i < table->count; i++){
+        if (cseMentions(table->entries[i].expression, name)) table->entries[i].killed = 1;
+    }
+}
+
+void cseTruncate(CseTable* table, size_t mark){
+    // 조건부로 평가되는 구간에서 등록된 엔트리는 이후에 사용할 수 없다
+    if (mark < table->count) table->count = mark;
+}
+
+void cseExpr(CseTable* table, Expr** site){
+    Expr* expr = *site;
+    if (expr == NULL) return;
+
+    if (expr->accept == ExprGroupingAccept){
+        cseExpr(table, &((ExprGrouping*)expr)->expression);
+        return;
+    }
+
+    int candidate = isCseCandidate(expr);
+    unsigned int hash = 0;
+    if (candidate){
+        hash = cseHash(expr);
+        CseEntry* entry = cseLookup(table, hash, expr);
+        if (entry){
+            *site = createCseUse(table, entry);
+            return;
+        }
+    }
+
+    if (expr->accept == ExprBinaryAccept){
+        cseExpr(table, &((ExprBinary*)expr)->left);
+        cseExpr(table, &((ExprBinary*)expr)->right);
+    } else if (expr->accept == ExprUnaryAccept){
+        cseExpr(table, &((ExprUnary*)expr)->right);
+    } else if (expr->accept == ExprLogicalAccept){
+        cseExpr(table, &((Logical*)expr)->left);
+        size_t mark = table->count;
+        cseExpr(table, &((Logical*)expr)->right);
+        cseTruncate(table, mark);
+    } else if (expr->accept == ExprAssignAccept){
+        cseExpr(table, &((Assign*)expr)->value);
+        cseKillAll(table);
+    } else if (expr->accept == ExprCallAccept){
+        Call* expr_call = (Call*)expr;
+        cseExpr(table, &expr_call->callee);
+        for (int i = 0; i < expr_call->arguments->count; i++){
+            Element* element = getElement(expr_call->arguments, i);
+            cseExpr(table, &element->data.expr_stmt->expression);
+        }
+        cseKillAll(table);
+    }
+
+    if (candidate) cseRegister(table, hash, site);
+}
+
+void cseStmt(CseTable* table, Stmt* stmt){
+    if (stmt == NULL) return;
+
+    if (stmt->accept == ExpressionStmtAccept){
+        cseExpr(table, &((Expression*)stmt)->expression);
+    } else if (stmt->accept == PrintStmtAccept){
+        cseExpr(table, &((Print*)stmt)->expression);
+    } else if (stmt->accept == VarStmtAccept){
+        Var* var_stmt = (Var*)stmt;
+        cseExpr(table, &var_stmt->initializer);
+        cseKillName(table, var_stmt->name->lexeme);
+    } else if (stmt->accept == BlockStmtAccept){
+        size_t mark = table->count;
+        cseStatements(table, ((Block*)stmt)->statements);
+        cseTruncate(table, mark);
+    } else if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        cseExpr(table, &if_stmt->condition);
+        size_t mark = table->count;
+        cseStmt(table, if_stmt->thenBranch);
+        cseTruncate(table, mark);
+        cseStmt(table, if_stmt->elseBranch);
+        cseTruncate(table, mark);
+    } else if (stmt->accept == WhileStmtAccept){
+        While* while_stmt = (While*)stmt;
+        // 조건식은 루프 본문 이후에 다시 평가되므로 루프 이전 엔트리를 사용할 수 없다
+        cseKillAll(table);
+        cseExpr(table, &while_stmt->condition);
+        size_t mark = table->count;
+        cseStmt(table, while_stmt->body);
+        cseTruncate(table, mark);
+    } else if (stmt->accept == FunctionStmtAccept){
+        Function* function_stmt = (Function*)stmt;
+        cseKillName(table, function_stmt->name->lexeme);
+        size_t previous_floor = table->floor;
+        size_t mark = table->count;
+        table->floor = mark;
+        cseStatements(table, function_stmt->body);
+        cseTruncate(table, mark);
+        table->floor = previous_floor;
+    } else if (stmt->accept == ReturnStmtAccept){
+        cseExpr(table, &((Return*)stmt)->value);
+    }
+}
+
+void cseStatements(CseTable* table, Array* statements){
+    for (int i = 0; i < statements->count; i++){
+        Element* element = getElement(statements, i);
+        Stmt* stmt = NULL;
+        if (element->type == PRINT_STMT){
+            stmt = (Stmt*)element->data.print_stmt;
+        } else if (element->type == EXPRESSION_STMT) {
+            stmt = (Stmt*)element->data.expr_stmt;
+        } else if (element->type == VAR_STMT){
+            stmt = (Stmt*)element->data.var_stmt;
+        } else if (element->type == BLOCK_STMT){
+            stmt = (Stmt*)element->data.block_stmt;
+        } else if (element->type == IF_STMT){
+            stmt = (Stmt*)element->data.if_stmt;
+        } else if (element->type == WHILE_STMT){
+            stmt = (Stmt*)element->data.while_stmt;
+        } else if (element->type == FUNCTION_STMT){
+            stmt = (Stmt*)element->data.function_stmt;
+        } else if (element->type == RETURN_STMT){
+            stmt = (Stmt*)element->data.return_stmt;
+        }
+        cseStmt(table, stmt);
+    }
+}
+
+int eliminateCommonSubexpressions(Array* statements){
+    CseTable* table = createCseTable();
+    cseStatements(table, statements);
+    int slot_count = table->slot_count;
+    releaseCseTable(table);
+    return slot_count;
+}
+
+// 상수 접기: 피연산자가 모두 리터럴인 단항식과 숫자 이항식을 실행 전에 계산해 리터럴로 바꾼다.
+// 파서가 만든 트리는 parse 명령이 그대로 출력하므로 run에서만 따로 접는다
+
+Expr* createFoldedLiteral(Value constant){
+    ExprLiteral* literal = heapAllocate(sizeof(ExprLiteral), HEAP_AST);
+    literal->base.accept = ExprLiteralAccept;
+    literal->constant = constant;
+    if (IS_NUMBER(constant)){
+        // CSE는 리터럴을 텍스트로 비교하므로 같은 값이면 같은 텍스트가 되도록 전체 정밀도로 적는다
+        literal->type = NUMBER;
+        literal->value = heapAllocate(32, HEAP_AST);
+        snprintf(literal->value, 32, "%.17g", AS_NUMBER(constant));
+    } else {
+        literal->type = isTruthy(constant) ? TRUE : FALSE;
+        literal->value = isTruthy(constant) ? "true" : "false";
+    }
+    return (Expr*)literal;
+}
+
+int foldNumberOperation(TokenType type, Value left, Value right, Value* result){
+    // 실행할 때와 같은 연산 함수를 써서 접은 값이 비트 단위로 같다
+    #define NUMBER_FOLD_CASE(name, token, operation) case token: *result = operation; return 1;
+    switch (type){
+        NUMBER_BINARY_OPERATIONS(NUMBER_FOLD_CASE)
+        case EQUAL_EQUAL: *result = numberEqualOperation(left, right, 0); return 1;
+        case BANG_EQUAL: *result = numberEqualOperation(left, right, 1); return 1;
+        default: return 0;
+    }
+    #undef NUMBER_FOLD_CASE
+}
+
+void foldExpr(Expr** site){
+    Expr* expr = *site;
+    if (expr == NULL) return;
+
+    if (expr->accept == ExprGroupingAccept){
+        foldExpr(&((ExprGrouping*)expr)->expression);
+        Expr* inner = ((ExprGrouping*)expr)->expression;
+        if (inner->accept == ExprLiteralAccept) *site = inner;
+    } else if (expr->accept == ExprUnaryAccept){
+        ExprUnary* expr_unary = (ExprUnary*)expr;
+        foldExpr(&expr_unary->right);
+        if (expr_unary->right->accept != ExprLiteralAccept) return;
+        Value right = ((ExprLiteral*)expr_unary->right)->constant;
+        if (expr_unary->operator->type == BANG){
+            *site = createFoldedLiteral(BOOL_VAL(!isTruthy(right)));
+        } else if (expr_unary->operator->type == MINUS && IS_NUMBER(right)){
+            *site = createFoldedLiteral(NUMBER_VAL(-AS_NUMBER(right)));
+        }
+    } else if (expr->accept == ExprBinaryAccept){
+        ExprBinary* expr_binary = (ExprBinary*)expr;
+        foldExpr(&expr_binary->left);
+        foldExpr(&expr_binary->right);
+        // 숫자가 아닌 피연산자는 실행 중 에러나 문자열 객체가 필요하므로 그대로 둔다
+        if (expr_binary->left->accept != ExprLiteralAccept || expr_binary->right->accept != ExprLiteralAccept) return;
+        Value left = ((ExprLiteral*)expr_binary->left)->constant;
+        Value right = ((ExprLiteral*)expr_binary->right)->constant;
+        Value result;
+        if (IS_NUMBER(left) && IS_NUMBER(right) && foldNumberOperation(expr_binary->operator->type, left, right, &result)){
+            *site = createFoldedLiteral(result);
+        }
+    } else if (expr->accept == ExprLogicalAccept){
+        foldExpr(&((Logical*)expr)->left);
+        foldExpr(&((Logical*)expr)->right);
+    } else if (expr->accept == ExprAssignAccept){
+        foldExpr(&((Assign*)expr)->value);
+    } else if (expr->accept == ExprCallAccept){
+        Call* expr_call = (Call*)expr;
+        foldExpr(&expr_call->callee);
+        for (int i = 0; i < expr_call->arguments->count; i++){
+            Element* element = getElement(expr_call->arguments, i);
+            foldExpr(&element->data.expr_stmt->expression);
+        }
+    }
+}
+
+void foldStmt(Stmt* stmt){
+    if (stmt == NULL) return;
+    if (stmt->accept == ExpressionStmtAccept){
+        foldExpr(&((Expression*)stmt)->expression);
+    } else if (stmt->accept == PrintStmtAccept){
+        foldExpr(&((Print*)stmt)->expression);
+    } else if (stmt->accept == VarStmtAccept){
+        foldExpr(&((Var*)stmt)->initializer);
+    } else if (stmt->accept == BlockStmtAccept){
+        foldConstants(((Block*)stmt)->statements);
+    } else if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        foldExpr(&if_stmt->condition);
+        foldStmt(if_stmt->thenBranch);
+        foldStmt(if_stmt->elseBranch);
+    } else if (stmt->accept == WhileStmtAccept){
+        foldExpr(&((While*)stmt)->condition);
+        foldStmt(((While*)stmt)->body);
+    } else if (stmt->accept == FunctionStmtAccept){
+        foldConstants(((Function*)stmt)->body);
+    } else if (stmt->accept == ReturnStmtAccept){
+        foldExpr(&((Return*)stmt)->value);
+    }
+}
+
+void foldConstants(Array* statements){
+    for (int i = 0; i < statements->count; i++){
+        foldStmt(elementStmt(getElement(statements, i)));
+    }
+}
+
+int isBinaryExpr(Expr* expr){
+    void* (*accept)(Expr*, Visitor*) = expr->accept;
+    return accept == ExprBinaryAccept
+        || isNumberOperatorAccept(number_operators, NUMBER_OPERATOR_COUNT, accept)
+        || isGuardedNumberExpr(expr);
+}
+
+int isUnaryExpr(Expr* expr){
+    return expr->accept == ExprUnaryAccept || expr->accept == ExprNumberNegateAccept;
+}
+
+InferredType joinInferredType(InferredType a, InferredType b){
+    if (a == b) return a;
+    return INFERRED_ANY;
+}
+
+TypedVariable* resolveTypedVariable(TypeInference* inference, char* name){
+    size_t floor = inference->in_function ? inference->function_floor : 0;
+    for (size_t i = inference->count; i > floor; i--){
+        TypedVariable* variable = &inference->variables[i - 1];
+        if (strcmp(variable->name, name) == 0) return variable;
+    }
+    if (!inference->in_function) return NULL;
+
+    // 함수는 전역 환경을 감싸므로 바깥 함수나 블록의 지역 변수는 보이지 않는다
+    for (size_t i = floor; i > 0; i--){
+        TypedVariable* variable = &inference->variables[i - 1];
+        if (variable->depth == 0 && strcmp(variable->name, name) == 0) return variable;
+    }
+    return NULL;
+}
+
+void declareTypedVariable(TypeInference* inference, char* name, InferredType type){
+    size_t floor = inference->in_function ? inference->function_floor : 0;
+    for (size_t i = inference->count; i > floor; i--){
+        TypedVariable* variable = &inference->variables[i - 1];
+        if (variable->depth != inference->depth) break;
+        if (strcmp(variable->name, name) == 0){
+            variable->type = type;
+            return;
+        }
+    }
+
+    if (inference->count >= inference->capacity){
+        inference->capacity *= 2;
+        inference->variables = heapReallocate(inference->variables, sizeof(TypedVariable) * inference->capacity, HEAP_RUNTIME);
+    }
+    TypedVariable* variable = &inference->variables[inference->count++];
+    variable->name = name;
+    variable->depth = inference->depth;
+    variable->type = type;
+}
+
+InferredType* saveInferredTypes(TypeInference* inference){
+    InferredType* types = (InferredType*)heapAllocate(sizeof(InferredType) * (inference->count + 1), HEAP_RUNTIME);
+    for (size_t i = 0; i < inference->count; i++){
+        types[i] = inference->variables[i].type;
+    }
+    return types;
+}
+
+void restoreInferredTypes(TypeInference* inference, InferredType* types){
+    for (size_t i = 0; i < inference->count; i++){
+        inference->variables[i].type = types[i];
+    }
+}
+
+void joinInferredTypes(TypeInference* inference, InferredType* other){
+    for (size_t i = 0; i < inference->count; i++){
+        inference->variables[i].type = joinInferredType(inference->variables[i].type, other[i]);
+    }
+}
+
+void forgetGlobalTypes(TypeInference* inference){
+    // 호출된 함수는 어떤 전역 변수든 다시 대입할 수 있다
+    for (size_t i = 0; i < inference->count; i++){
+        if (inference->variables[i].depth == 0) inference->variables[i].type = INFERRED_ANY;
+    }
+}
+
+void specializeBinaryExpr(ExprBinary* expr_binary){
+    const NumberOperator* number_operator = findNumberOperator(number_operators, NUMBER_OPERATOR_COUNT, expr_binary->operator->type);
+    if (number_operator) expr_binary->base.accept = number_operator->accept;
+}
+
+InferredType inferExpr(TypeInference* inference, Expr* expr){
+    if (expr->accept == ExprLiteralAccept){
+        switch (((ExprLiteral*)expr)->type){
+            case NUMBER: return INFERRED_NUMBER;
+            case STRING: return INFERRED_STRING;
+            case TRUE:
+            case FALSE: return INFERRED_BOOL;
+            case NIL: return INFERRED_NIL;
+            default: return INFERRED_ANY;
+        }
+    }
+    if (expr->accept == ExprGroupingAccept){
+        return inferExpr(inference, ((ExprGrouping*)expr)->expression);
+    }
+    if (expr->accept == ExprCseDefAccept){
+        return inferExpr(inference, ((CseDef*)expr)->expression);
+    }
+    if (expr->accept == ExprCseUseAccept){
+        // 순수한 식이므로 상태를 바꾸지 않고 정의 지점의 식으로 타입만 다시 계산한다
+        int dry_run = inference->dry_run;
+        inference->dry_run = 1;
+        InferredType type = inferExpr(inference, ((CseUse*)expr)->def->expression);
+        inference->dry_run = dry_run;
+        return type;
+    }
+    if (expr->accept == ExprVariableAccept){
+        TypedVariable* variable = resolveTypedVariable(inference, ((Variable*)expr)->name->lexeme);
+        if (variable == NULL) return INFERRED_ANY;
+        if (inference->in_function && variable->depth == 0) return INFERRED_ANY;
+        return variable->type;
+    }
+    if (expr->accept == ExprAssignAccept){
+        Assign* expr_assign = (Assign*)expr;
+        InferredType type = inferExpr(inference, expr_assign->value);
+        TypedVariable* variable = resolveTypedVariable(inference, expr_assign->name->lexeme);
+        if (variable && !(inference->in_function && variable->depth == 0)) variable->type = type;
+        return type;
+    }
+    if (isUnaryExpr(expr)){
+        ExprUnary* expr_unary = (ExprUnary*)expr;
+        InferredType right = inferExpr(inference, expr_unary->right);
+        if (expr_unary->operator->type == BANG) return INFERRED_BOOL;
+        if (right != INFERRED_NUMBER) return INFERRED_ANY;
+        if (!inference->dry_run && expr->accept == ExprUnaryAccept){
+            expr->accept = ExprNumberNegateAccept;
+            inference->specialized_count++;
+        }
+        return INFERRED_NUMBER;
+    }
+    if (isBinaryExpr(expr)){
+        ExprBinary* expr_binary = (ExprBinary*)expr;
+        InferredType left = inferExpr(inference, expr_binary->left);
+        InferredType right = inferExpr(inference, expr_binary->right);
+        TokenType operator = expr_binary->operator->type;
+
+        if (left != INFERRED_NUMBER || right != INFERRED_NUMBER){
+            // 실패할 수 있는 연산의 결과는 오류 경로 때문에 증명할 수 없다
+            if (operator == EQUAL_EQUAL || operator == BANG_EQUAL) return INFERRED_BOOL;
+            if (operator == PLUS && left == INFERRED_STRING && right == INFERRED_STRING) return INFERRED_STRING;
+            return INFERRED_ANY;
+        }
+        if (!inference->dry_run && expr->accept == ExprBinaryAccept){
+            specializeBinaryExpr(expr_binary);
+            inference->specialized_count++;
+        }
+        if (operator == PLUS || operator == MINUS || operator == STAR || operator == SLASH){
+            return INFERRED_NUMBER;
+        }
+        return INFERRED_BOOL;
+    }
+    if (expr->accept == ExprLogicalAccept){
+        Logical* expr_logical = (Logical*)expr;
+        InferredType left = inferExpr(inference, expr_logical->left);
+        InferredType* skipped = saveInferredTypes(inference);
+        InferredType right = inferExpr(inference, expr_logical->right);
+        joinInferredTypes(inference, skipped);
+        heapFree(skipped);
+        return joinInferredType(left, right);
+    }
+    if (expr->accept == ExprCallAccept){
+        Call* expr_call = (Call*)expr;
+        inferExpr(inference, expr_call->callee);
+        for (int i = 0; i < expr_call->arguments->count; i++){
+            Element* element = getElement(expr_call->arguments, i);
+            inferExpr(inference, element->data.expr_stmt->expression);
+        }
+        if (!inference->in_function) forgetGlobalTypes(inference);
+        return INFERRED_ANY;
+    }
+    return INFERRED_ANY;
+}
+
+void inferStmt(TypeInference* inference, Stmt* stmt){
+    if (stmt == NULL) return;
+
+    if (stmt->accept == ExpressionStmtAccept){
+        inferExpr(inference, ((Expression*)stmt)->expression);
+    } else if (stmt->accept == PrintStmtAccept){
+        inferExpr(inference, ((Print*)stmt)->expression);
+    } else if (stmt->accept == VarStmtAccept){
+        Var* var_stmt = (Var*)stmt;
+        InferredType type = inferExpr(inference, var_stmt->initializer);
+        declareTypedVariable(inference, var_stmt->name->lexeme, type);
+    } else if (stmt->accept == BlockStmtAccept){
+        size_t mark = inference->count;
+        inference->depth++;
+        inferStatements(inference, ((Block*)stmt)->statements);
+        inference->depth--;
+        inference->count = mark;
+    } else if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        inferExpr(inference, if_stmt->condition);
+        InferredType* before = saveInferredTypes(inference);
+        inferStmt(inference, if_stmt->thenBranch);
+        InferredType* after_then = saveInferredTypes(inference);
+        restoreInferredTypes(inference, before);
+        inferStmt(inference, if_stmt->elseBranch);
+        joinInferredTypes(inference, after_then);
+        heapFree(before);
+        heapFree(after_then);
+    } else if (stmt->accept == WhileStmtAccept){
+        While* while_stmt = (While*)stmt;
+
+        // 루프 머리의 타입이 더 이상 변하지 않을 때까지 노드를 바꾸지 않고 반복한다
+        int dry_run = inference->dry_run;
+        inference->dry_run = 1;
+        InferredType* head = saveInferredTypes(inference);
+        while (1){
+            inferExpr(inference, while_stmt->condition);
+            inferStmt(inference, while_stmt->body);
+            joinInferredTypes(inference, head);
+            InferredType* next = saveInferredTypes(inference);
+            int stable = memcmp(next, head, sizeof(InferredType) * inference->count) == 0;
+            heapFree(head);
+            head = next;
+            if (stable) break;
+        }
+        inference->dry_run = dry_run;
+
+        restoreInferredTypes(inference, head);
+        inferExpr(inference, while_stmt->condition);
+        InferredType* exit_types = saveInferredTypes(inference);
+        inferStmt(inference, while_stmt->body);
+        restoreInferredTypes(inference, exit_types);
+        heapFree(head);
+        heapFree(exit_types);
+    } else if (stmt->accept == FunctionStmtAccept){
+        Function* function_stmt = (Function*)stmt;
+        declareTypedVariable(inference, function_stmt->name->lexeme, INFERRED_ANY);
+
+        size_t previous_floor = inference->function_floor;
+        int previous_in_function = inference->in_function;
+        size_t mark = inference->count;
+        inference->function_floor = mark;
+        inference->in_function = 1;
+        inference->depth++;
+        for (int i = 0; i < function_stmt->params->count; i++){
+            Element* param = getElement(function_stmt->params, i);
+            declareTypedVariable(inference, param->data.token->lexeme, INFERRED_ANY);
+        }
+        inferStatements(inference, function_stmt->body);
+        inference->depth--;
+        inference->count = mark;
+        inference->in_function = previous_in_function;
+        inference->function_floor = previous_floor;
+    } else if (stmt->accept == ReturnStmtAccept){
+        Expr* value = ((Return*)stmt)->value;
+        if (value) inferExpr(inference, value);
+    }
+}
+
+void inferStatements(TypeInference* inference, Array* statements){
+    for (int i = 0; i < statements->count; i++){
+        Element* element = getElement(statements, i);
+        Stmt* stmt = NULL;
+        if (element->type == PRINT_STMT){
+            stmt = (Stmt*)element->data.print_stmt;
+        } else if (element->type == EXPRESSION_STMT) {
+            stmt = (Stmt*)element->data.expr_stmt;
+        } else if (element->type == VAR_STMT){
+            stmt = (Stmt*)element->data.var_stmt;
+        } else if (element->type == BLOCK_STMT){
+            stmt = (Stmt*)element->data.block_stmt;
+        } else if (element->type == IF_STMT){
+            stmt = (Stmt*)element->data.if_stmt;
+        } else if (element->type == WHILE_STMT){
+            stmt = (Stmt*)element->data.while_stmt;
+        } else if (element->type == FUNCTION_STMT){
+            stmt = (Stmt*)element->data.function_stmt;
+        } else if (element->type == RETURN_STMT){
+            stmt = (Stmt*)element->data.return_stmt;
+        }
+        inferStmt(inference, stmt);
+    }
+}
+
+int specializeNumericNodes(Array* statements){
+    TypeInference* inference = (TypeInference*)heapAllocate(sizeof(TypeInference), HEAP_RUNTIME);
+    inference->capacity = INITIAL_LIST_SIZE;
+    inference->variables = (TypedVariable*)heapAllocate(sizeof(TypedVariable) * inference->capacity, HEAP_RUNTIME);
+    inference->count = 0;
+    inference->function_floor = 0;
+    inference->depth = 0;
+    inference->in_function = 0;
+    inference->dry_run = 0;
+    inference->specialized_count = 0;
+
+    inferStatements(inference, statements);
+
+    int specialized_count = inference->specialized_count;
+    heapFree(inference->variables);
+    heapFree(inference);
+    return specialized_count;
+}
+
+MemoTable* createMemoTable(int arity, int capacity){
+    MemoTable* memo = (MemoTable*)heapAllocate(sizeof(MemoTable), HEAP_RUNTIME);
+    memo->entries = NULL;
+    memo->buckets = NULL;
+    memo->capacity = capacity;
+    memo->count = 0;
+    memo->oldest = 0;
+    memo->arity = arity;
+    memo->hits = 0;
+    memo->misses = 0;
+    memo->evictions = 0;
+    memo->disabled = 0;
+    return memo;
+}
+
+void releaseMemoEntries(MemoTable* memo){
+    if (memo->entries == NULL) return;
+    for (int i = 0; i < memo->count; i++){
+        heapFree(memo->entries[i].arguments);
+    }
+    heapFree(memo->entries);
+    heapFree(memo->buckets);
+    memo->entries = NULL;
+    memo->buckets = NULL;
+    memo->count = 0;
+    memo->oldest = 0;
+}
+
+void memoRecordMiss(MemoTable* memo){
+    memo->misses++;
+    if (memo->misses % MEMO_PROBE_MISSES != 0) return;
+    long calls = memo->hits + memo->misses;
+    if (memo->hits * 100 >= calls * MEMO_MIN_HIT_PERCENT) return;
+    // 같은 인자가 거의 다시 오지 않는다. 찾고 저장하는 비용만 드니 끄고 테이블을 돌려준다
+    memo->disabled = 1;
+    releaseMemoEntries(memo);
+}
+
+int isMemoizableArguments(Value* arguments, int arg_count){
+    for (int i = 0; i < arg_count; i++){
+        Value value = arguments[i];
+        // 로프는 인턴되어 있지 않아 내용으로 비교해야 하므로 제외한다
+        if (IS_OBJ(value) && !IS_STRING(value)) return 0;
+    }
+    return 1;
+}
+
+unsigned int memoHash(Value* arguments, int arg_count){
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < arg_count; i++){
+        Value argument = arguments[i];
+        unsigned int value;
+        if (IS_STRING(argument)){
+            value = AS_STRING(argument)->hash;
+        } else {
+            value = (unsigned int)(argument ^ (argument >> 32));
+        }
+        hash = (hash ^ value) * 16777619u;
+    }
+    return hash;
+}
+
+int memoArgumentEqual(Value a, Value b){
+    // 문자열은 인턴되어 있고, -0과 0은 구분해야 하므로 비트 단위로 비교한다
+    return a == b;
+}
+
+MemoEntry* memoLookup(MemoTable* memo, Value* arguments, unsigned int hash){
+    if (memo->buckets == NULL) return NULL;
+    int index = memo->buckets[hash % memo->capacity];
+    while (index != -1){
+        MemoEntry* entry = &memo->entries[index];
+        if (entry->hash == hash){
+            int equal = 1;
+            for (int i = 0; i < memo->arity && equal; i++){
+                equal = memoArgumentEqual(entry->arguments[i], arguments[i]);
+            }
+            if (equal) return entry;
+        }
+        index = entry->next;
+    }
+    return NULL;
+}
+
+void memoStore(MemoTable* memo, Value* arguments, unsigned int hash, Value result){
+    if (memo->entries == NULL){
+        memo->entries = (MemoEntry*)heapAllocate(sizeof(MemoEntry) * memo->capacity, HEAP_RUNTIME);
+        memo->buckets = (int*)heapAllocate(sizeof(int) * memo->capacity, HEAP_RUNTIME);
+        for (int i = 0; i < memo->capacity; i++){
+            memo->buckets[i] = -1;
+        }
+    }
+    int index;
+    if (memo->count < memo->capacity){
+        index = memo->count++;
+        memo->entries[index].arguments = (Value*)heapAllocate(sizeof(Value) * (memo->arity + 1), HEAP_RUNTIME);
+    } else {
+        index = memo->oldest;
+        memo->oldest = (memo->oldest + 1) % memo->capacity;
+        memo->evictions++;
+
+        MemoEntry* evicted = &memo->entries[index];
+        int* link = &memo->buckets[evicted->hash % memo->capacity];
+        while (*link != index){
+            link = &memo->entries[*link].next;
+        }
+        *link = evicted->next;
+    }
+
+    MemoEntry* entry = &memo->entries[index];
+    for (int i = 0; i < memo->arity; i++){
+        entry->arguments[i] = arguments[i];
+    }
+    entry->result = promoteValue(result);
+    entry->hash = hash;
+    entry->next = memo->buckets[hash % memo->capacity];
+    memo->buckets[hash % memo->capacity] = index;
+}
+
+int isAssignedName(PurityAnalysis* analysis, char* name){
+    for (size_t i = 0; i < analysis->assigned_count; i++){
+        if (strcmp(analysis->assigned[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+GlobalName* findGlobalName(PurityAnalysis* analysis, char* name){
+    for (size_t i = 0; i < analysis->global_count; i++){
+        if (strcmp(analysis->globals[i].name, name) == 0) return &analysis->globals[i];
+    }
+    return NULL;
+}
+
+void declareGlobalName(PurityAnalysis* analysis, char* name, Function* function){
+    GlobalName* global = findGlobalName(analysis, name);
+    if (global){
+        global->declarations++;
+        return;
+    }
+    if (analysis->global_count >= analysis->global_capacity){
+        analysis->global_capacity *= 2;
+        analysis->globals = heapReallocate(analysis->globals, sizeof(GlobalName) * analysis->global_capacity, HEAP_RUNTIME);
+    }
+    global = &analysis->globals[analysis->global_count++];
+    global->name = name;
+    global->declarations = 1;
+    global->function = function;
+}
+
+void addAssignedName(PurityAnalysis* analysis, char* name){
+    if (isAssignedName(analysis, name)) return;
+    if (analysis->assigned_count >= analysis->assigned_capacity){
+        analysis->assigned_capacity *= 2;
+        analysis->assigned = heapReallocate(analysis->assigned, sizeof(char*) * analysis->assigned_capacity, HEAP_RUNTIME);
+    }
+    analysis->assigned[analysis->assigned_count++] = name;
+}
+
+void pushLocalName(PurityAnalysis* analysis, char* name){
+    if (analysis->local_count >= analysis->local_capacity){
+        analysis->local_capacity *= 2;
+        analysis->locals = heapReallocate(analysis->locals, sizeof(char*) * analysis->local_capacity, HEAP_RUNTIME);
+    }
+    analysis->locals[analysis->local_count++] = name;
+}
+
+int isLocalName(PurityAnalysis* analysis, char* name){
+    for (size_t i = analysis->local_count; i > 0; i--){
+        if (strcmp(analysis->locals[i - 1], name) == 0) return 1;
+    }
+    return 0;
+}
+
+// 한 번만 선언되고 어디에서도 대입되지 않는 전역 이름만 값이 고정된다
+GlobalName* findImmutableGlobal(PurityAnalysis* analysis, char* name){
+    GlobalName* global = findGlobalName(analysis, name);
+    if (global == NULL || global->declarations != 1 || isAssignedName(analysis, name)) return NULL;
+    return global;
+}
+
+Stmt* elementStmt(Element* element){
+    if (element->type == PRINT_STMT) return (Stmt*)element->data.print_stmt;
+    if (element->type == EXPRESSION_STMT) return (Stmt*)element->data.expr_stmt;
+    if (element->type == VAR_STMT) return (Stmt*)element->data.var_stmt;
+    if (element->type == BLOCK_STMT) return (Stmt*)element->data.block_stmt;
+    if (element->type == IF_STMT) return (Stmt*)element->data.if_stmt;
+    if (element->type == WHILE_STMT) return (Stmt*)element->data.while_stmt;
+    if (element->type == FUNCTION_STMT) return (Stmt*)element->data.function_stmt;
+    if (element->type == RETURN_STMT) return (Stmt*)element->data.return_stmt;
+    return NULL;
+}
+
+void collectPurityFactsExpr(PurityAnalysis* analysis, Expr* expr){
+    if (expr == NULL) return;
+    if (expr->accept == ExprGroupingAccept){
+        collectPurityFactsExpr(analysis, ((ExprGrouping*)expr)->expression);
+    } else if (expr->accept == ExprCseDefAccept){
+        collectPurityFactsExpr(analysis, ((CseDef*)expr)->expression);
+    } else if (isUnaryExpr(expr)){
+        collectPurityFactsExpr(analysis, ((ExprUnary*)expr)->right);
+    } else if (isBinaryExpr(expr)){
+        collectPurityFactsExpr(analysis, ((ExprBinary*)expr)->left);
+        collectPurityFactsExpr(analysis, ((ExprBinary*)expr)->right);
+    } else if (expr->accept == ExprLogicalAccept){
+        collectPurityFactsExpr(analysis, ((Logical*)expr)->left);
+        collectPurityFactsExpr(analysis, ((Logical*)expr)->right);
+    } else if (expr->accept == ExprAssignAccept){
+        addAssignedName(analysis, ((Assign*)expr)->name->lexeme);
+        collectPurityFactsExpr(analysis, ((Assign*)expr)->value);
+    } else if (expr->accept == ExprCallAccept){
+        Call* expr_call = (Call*)expr;
+        collectPurityFactsExpr(analysis, expr_call->callee);
+        for (int i = 0; i < expr_call->arguments->count; i++){
+            Element* element = getElement(expr_call->arguments, i);
+            collectPurityFactsExpr(analysis, element->data.expr_stmt->expression);
+        }
+    }
+}
+
+void collectPurityFactsStmt(PurityAnalysis* analysis, Stmt* stmt, int top_level){
+    if (stmt == NULL) return;
+    if (stmt->accept == ExpressionStmtAccept){
+        collectPurityFactsExpr(analysis, ((Expression*)stmt)->expression);
+    } else if (stmt->accept == PrintStmtAccept){
+        collectPurityFactsExpr(analysis, ((Print*)stmt)->expression);
+    } else if (stmt->accept == VarStmtAccept){
+        Var* var_stmt = (Var*)stmt;
+        collectPurityFactsExpr(analysis, var_stmt->initializer);
+        if (top_level) declareGlobalName(analysis, var_stmt->name->lexeme, NULL);
+    } else if (stmt->accept == BlockStmtAccept){
+        collectPurityFacts(analysis, ((Block*)stmt)->statements, 0);
+    } else if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        collectPurityFactsExpr(analysis, if_stmt->condition);
+        collectPurityFactsStmt(analysis, if_stmt->thenBranch, 0);
+        collectPurityFactsStmt(analysis, if_stmt->elseBranch, 0);
+    } else if (stmt->accept == WhileStmtAccept){
+        collectPurityFactsExpr(analysis, ((While*)stmt)->condition);
+        collectPurityFactsStmt(analysis, ((While*)stmt)->body, 0);
+    } else if (stmt->accept == FunctionStmtAccept){
+        Function* function_stmt = (Function*)stmt;
+        if (top_level) declareGlobalName(analysis, function_stmt->name->lexeme, function_stmt);
+        Element element;
+        element.type = FUNCTION_STMT;
+        element.data.function_stmt = function_stmt;
+        addElement(analysis->functions, element);
+        collectPurityFacts(analysis, function_stmt->body, 0);
+    } else if (stmt->accept == ReturnStmtAccept){
+        collectPurityFactsExpr(analysis, ((Return*)stmt)->value);
+    }
+}
+
+void collectPurityFacts(PurityAnalysis* analysis, Array* statements, int top_level){
+    for (int i = 0; i < statements->count; i++){
+        collectPurityFactsStmt(analysis, elementStmt(getElement(statements, i)), top_level);
+    }
+}
+
+// 고정된 전역 함수를 부르는 callee면 analysis->functions에서의 위치, 아니면 -1
+int globalFunctionIndex(PurityAnalysis* analysis, Expr* callee){
+    if (callee->accept != ExprVariableAccept) return -1;
+    GlobalName* global = findImmutableGlobal(analysis, ((Variable*)callee)->name->lexeme);
+    if (global == NULL || global->function == NULL) return -1;
+    for (int i = 0; i < analysis->functions->count; i++){
+        Element* element = getElement(analysis->functions, i);
+        if (element->data.function_stmt == global->function) return i;
+    }
+    return -1;
+}
+
+int isPureCallee(PurityAnalysis* analysis, Expr* callee){
+    if (callee->accept == ExprVariableAccept && isLocalName(analysis, ((Variable*)callee)->name->lexeme)) return 0;
+    int index = globalFunctionIndex(analysis, callee);
+    return index >= 0 && analysis->pure[index];
+}
+
+int isPureExprIn(PurityAnalysis* analysis, Expr* expr){
+    if (expr == NULL) return 1;
+    if (expr->accept == ExprLiteralAccept || expr->accept == ExprCseUseAccept) return 1;
+    if (expr->accept == ExprGroupingAccept) return isPureExprIn(analysis, ((ExprGrouping*)expr)->expression);
+    if (expr->accept == ExprCseDefAccept) return isPureExprIn(analysis, ((CseDef*)expr)->expression);
+    if (expr->accept == ExprVariableAccept){
+        char* name = ((Variable*)expr)->name->lexeme;
+        return isLocalName(analysis, name) || findImmutableGlobal(analysis, name) != NULL;
+    }
+    if (expr->accept == ExprAssignAccept){
+        Assign* expr_assign = (Assign*)expr;
+        return isLocalName(analysis, expr_assign->name->lexeme) && isPureExprIn(analysis, expr_assign->value);
+    }
+    if (isUnaryExpr(expr)) return isPureExprIn(analysis, ((ExprUnary*)expr)->right);
+    if (isBinaryExpr(expr)){
+        return isPureExprIn(analysis, ((ExprBinary*)expr)->left) && isPureExprIn(analysis, ((ExprBinary*)expr)->right);
+    }
+    if (expr->accept == ExprLogicalAccept){
+        return isPureExprIn(analysis, ((Logical*)expr)->left) && isPureExprIn(analysis, ((Logical*)expr)->right);
+    }
+    if (expr->accept == ExprCallAccept){
+        Call* expr_call = (Call*)expr;
+        if (!isPureCallee(analysis, expr_call->callee)) return 0;
+        for (int i = 0; i < expr_call->arguments->count; i++){
+            Element* element = getElement(expr_call->arguments, i);
+            if (!isPureExprIn(analysis, element->data.expr_stmt->expression)) return 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int isPureStatements(PurityAnalysis* analysis, Array* statements);
+
+int isPureStmt(PurityAnalysis* analysis, Stmt* stmt){
+    if (stmt == NULL) return 1;
+    if (stmt->accept == PrintStmtAccept) return 0;
+    if (stmt->accept == ExpressionStmtAccept) return isPureExprIn(analysis, ((Expression*)stmt)->expression);
+    if (stmt->accept == VarStmtAccept){
+        Var* var_stmt = (Var*)stmt;
+        if (!isPureExprIn(analysis, var_stmt->initializer)) return 0;
+        pushLocalName(analysis, var_stmt->name->lexeme);
+        return 1;
+    }
+    if (stmt->accept == BlockStmtAccept){
+        size_t mark = analysis->local_count;
+        int pure = isPureStatements(analysis, ((Block*)stmt)->statements);
+        analysis->local_count = mark;
+        return pure;
+    }
+    if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        return isPureExprIn(analysis, if_stmt->condition)
+            && isPureStmt(analysis, if_stmt->thenBranch) && isPureStmt(analysis, if_stmt->elseBranch);
+    }
+    if (stmt->accept == WhileStmtAccept){
+        return isPureExprIn(analysis, ((While*)stmt)->condition) && isPureStmt(analysis, ((While*)stmt)->body);
+    }
+    // 중첩 함수 선언은 호출마다 새 함수 객체를 만들므로 결과를 재사용하면 동일성이 바뀐다
+    if (stmt->accept == FunctionStmtAccept) return 0;
+    if (stmt->accept == ReturnStmtAccept) return isPureExprIn(analysis, ((Return*)stmt)->value);
+    return 0;
+}
+
+int isPureStatements(PurityAnalysis* analysis, Array* statements){
+    for (int i = 0; i < statements->count; i++){
+        if (!isPureStmt(analysis, elementStmt(getElement(statements, i)))) return 0;
+    }
+    return 1;
+}
+
+int repeatsWorkStatements(PurityAnalysis* analysis, Array* statements, Function* target);
+
+// 식을 평가하는 동안 target으로 다시 들어오는지. 순수 함수의 callee는 모두 고정된 전역 함수다
+int repeatsWorkExpr(PurityAnalysis* analysis, Expr* expr, Function* target){
+    if (expr == NULL) return 0;
+    if (expr->accept == ExprGroupingAccept) return repeatsWorkExpr(analysis, ((ExprGrouping*)expr)->expression, target);
+    if (expr->accept == ExprCseDefAccept) return repeatsWorkExpr(analysis, ((CseDef*)expr)->expression, target);
+    if (expr->accept == ExprAssignAccept) return repeatsWorkExpr(analysis, ((Assign*)expr)->value, target);
+    if (isUnaryExpr(expr)) return repeatsWorkExpr(analysis, ((ExprUnary*)expr)->right, target);
+    if (isBinaryExpr(expr)){
+        return repeatsWorkExpr(analysis, ((ExprBinary*)expr)->left, target)
+            || repeatsWorkExpr(analysis, ((ExprBinary*)expr)->right, target);
+    }
+    if (expr->accept == ExprLogicalAccept){
+        return repeatsWorkExpr(analysis, ((Logical*)expr)->left, target)
+            || repeatsWorkExpr(analysis, ((Logical*)expr)->right, target);
+    }
+    if (expr->accept == ExprCallAccept){
+        Call* expr_call = (Call*)expr;
+        for (int i = 0; i < expr_call->arguments->count; i++){
+            Element* element = getElement(expr_call->arguments, i);
+            if (repeatsWorkExpr(analysis, element->data.expr_stmt->expression, target)) return 1;
+        }
+        int index = globalFunctionIndex(analysis, expr_call->callee);
+        if (index < 0 || analysis->visited[index]) return 0;
+        analysis->visited[index] = 1;
+        Function* callee = ((Element*)getElement(analysis->functions, index))->data.function_stmt;
+        return callee == target || repeatsWorkStatements(analysis, callee->body, target);
+    }
+    return 0;
+}
+
+// 반복문을 돌거나 target으로 돌아오는 호출이 있는지
+int repeatsWorkStmt(PurityAnalysis* analysis, Stmt* stmt, Function* target){
+    if (stmt == NULL) return 0;
+    if (stmt->accept == WhileStmtAccept) return 1;
+    if (stmt->accept == ExpressionStmtAccept) return repeatsWorkExpr(analysis, ((Expression*)stmt)->expression, target);
+    if (stmt->accept == VarStmtAccept) return repeatsWorkExpr(analysis, ((Var*)stmt)->initializer, target);
+    if (stmt->accept == ReturnStmtAccept) return repeatsWorkExpr(analysis, ((Return*)stmt)->value, target);
+    if (stmt->accept == BlockStmtAccept) return repeatsWorkStatements(analysis, ((Block*)stmt)->statements, target);
+    if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        return repeatsWorkExpr(analysis, if_stmt->condition, target)
+            || repeatsWorkStmt(analysis, if_stmt->thenBranch, target)
+            || repeatsWorkStmt(analysis, if_stmt->elseBranch, target);
+    }
+    return 0;
+}
+
+int repeatsWorkStatements(PurityAnalysis* analysis, Array* statements, Function* target){
+    for (int i = 0; i < statements->count; i++){
+        if (repeatsWorkStmt(analysis, elementStmt(getElement(statements, i)), target)) return 1;
+    }
+    return 0;
+}
+
+// 인자 몇 개를 읽고 끝나는 함수는 찾고 저장하는 비용이 본문보다 크다.
+// 재귀하거나 반복문을 도는 순수 함수만 메모한다
+int isWorthMemoizing(PurityAnalysis* analysis, Function* function){
+    for (int i = 0; i < analysis->functions->count; i++){
+        analysis->visited[i] = 0;
+    }
+    return repeatsWorkStatements(analysis, function->body, function);
+}
+
+int isPureFunction(PurityAnalysis* analysis, Function* function){
+    analysis->local_count = 0;
+    for (int i = 0; i < function->params->count; i++){
+        Element* param = getElement(function->params, i);
+        pushLocalName(analysis, param->data.token->lexeme);
+    }
+    return isPureStatements(analysis, function->body);
+}
+
+Array* memoizePureFunctions(Array* statements, int capacity){
+    PurityAnalysis analysis;
+    analysis.global_capacity = INITIAL_LIST_SIZE;
+    analysis.globals = (GlobalName*)heapAllocate(sizeof(GlobalName) * analysis.global_capacity, HEAP_RUNTIME);
+    analysis.global_count = 0;
+    analysis.assigned_capacity = INITIAL_LIST_SIZE;
+    analysis.assigned = (char**)heapAllocate(sizeof(char*) * analysis.assigned_capacity, HEAP_RUNTIME);
+    analysis.assigned_count = 0;
+    analysis.local_capacity = INITIAL_LIST_SIZE;
+    analysis.locals = (char**)heapAllocate(sizeof(char*) * analysis.local_capacity, HEAP_RUNTIME);
+    analysis.local_count = 0;
+    analysis.functions = createArray(INITIAL_LIST_SIZE);
+
+    collectPurityFacts(&analysis, statements, 1);
+
+    // 재귀 호출을 허용하기 위해 모두 순수하다고 가정하고 아닌 함수를 제거해 나간다
+    analysis.pure = (int*)heapAllocate(sizeof(int) * (analysis.functions->count + 1), HEAP_RUNTIME);
+    for (int i = 0; i < analysis.functions->count; i++){
+        analysis.pure[i] = 1;
+    }
+    int changed = 1;
+    while (changed){
+        changed = 0;
+        for (int i = 0; i < analysis.functions->count; i++){
+            if (!analysis.pure[i]) continue;
+            Element* element = getElement(analysis.functions, i);
+            if (!isPureFunction(&analysis, element->data.function_stmt)){
+                analysis.pure[i] = 0;
+                changed = 1;
+            }
+        }
+    }
+
+    Array* memoized = createArray(INITIAL_LIST_SIZE);
+    analysis.visited = (int*)heapAllocate(sizeof(int) * (analysis.functions->count + 1), HEAP_RUNTIME);
+    for (int i = 0; i < analysis.functions->count; i++){
+        if (!analysis.pure[i]) continue;
+        Element* element = getElement(analysis.functions, i);
+        Function* function = element->data.function_stmt;
+        if (!isWorthMemoizing(&analysis, function)) continue;
+        function->memo = createMemoTable(function->params->count, capacity);
+        addElement(memoized, *element);
+    }
+
+    heapFree(analysis.globals);
+    heapFree(analysis.assigned);
+    heapFree(analysis.locals);
+    heapFree(analysis.pure);
+    heapFree(analysis.visited);
+    releaseArray(analysis.functions);
+    return memoized;
+}
+
+void printMemoStats(Array* functions){
+    for (int i = 0; i < functions->count; i++){
+        Function* function = ((Element*)getElement(functions, i))->data.function_stmt;
+        MemoTable* memo = function->memo;
+        long calls = memo->hits + memo->misses;
+        double hit_rate = calls ? 100.0 * memo->hits / calls : 0.0;
+        fprintf(stderr, "[memo] %s: %ld hits, %ld misses (%.1f%% hit rate), %ld evictions, %d entries%s\n",
+                function->name->lexeme, memo->hits, memo->misses, hit_rate, memo->evictions, memo->count,
+                memo->disabled ? " (disabled, low hit rate)" : "");
+    }
+}
+
+// 함수 선언을 포함하는 스코프는 클로저가 환경을 붙잡을 수 있으므로 힙에 남긴다.
+// 반환값: 이 문장 안에 함수 선언이 있는지
+int analyzeEscapingStmt(Stmt* stmt){
+    if (stmt == NULL) return 0;
+    if (stmt->accept == BlockStmtAccept){
+        Block* block_stmt = (Block*)stmt;
+        block_stmt->escapes = analyzeEscapingScopes(block_stmt->statements);
+        return block_stmt->escapes;
+    }
+    if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        int then_escapes = analyzeEscapingStmt(if_stmt->thenBranch);
+        int else_escapes = analyzeEscapingStmt(if_stmt->elseBranch);
+        return then_escapes || else_escapes;
+    }
+    if (stmt->accept == WhileStmtAccept){
+        return analyzeEscapingStmt(((While*)stmt)->body);
+    }
+    if (stmt->accept == FunctionStmtAccept){
+        Function* function_stmt = (Function*)stmt;
+        function_stmt->escapes = analyzeEscapingScopes(function_stmt->body);
+        return 1;
+    }
+    return 0;
+}
+
+int analyzeEscapingScopes(Array* statements){
+    int escapes = 0;
+    for (int i = 0; i < statements->count; i++){
+        if (analyzeEscapingStmt(elementStmt(getElement(statements, i)))) escapes = 1;
+    }
+    return escapes;
+}
+
+size_t objectSize(Object* object){
+    switch (object->type){
+        case STRING:
+            return sizeof(Object) + sizeof(StringValue) + ((StringValue*)object->value)->length + 1;
+        case ROPE:
+            return sizeof(Object) + sizeof(RopeValue);
+        default:
+            return sizeof(Object) + sizeof(LoxFunction);
+    }
+}
+
+void trackObject(Object* object){
+    object->next = NULL;
+    if (!gc.enabled){
+        object->mark_epoch = GC_PINNED;
+        return;
+    }
+    object->mark_epoch = 0;
+    object->next = gc.objects;
+    gc.objects = object;
+    gc.bytes_allocated += objectSize(object);
+}
+
+void trackEnvironment(Environment* env){
+    if (!gc.enabled) return;
+    env->gc_next = gc.environments;
+    gc.environments = env;
+    gc.bytes_allocated += sizeof(Environment);
+}
+
+void pushEnvironmentRoot(Environment* env){
+    if (gc.env_root_count == gc.env_root_capacity){
+        gc.env_root_capacity = gc.env_root_capacity == 0 ? 64 : gc.env_root_capacity * 2;
+        gc.env_roots = (Environment**)heapReallocate(gc.env_roots, sizeof(Environment*) * gc.env_root_capacity, HEAP_RUNTIME);
+    }
+    gc.env_roots[gc.env_root_count++] = env;
+}
+
+void popEnvironmentRoot(){
+    gc.env_root_count--;
+}
+
+void pushTempRoot(Value value){
+    if (gc.temp_count == gc.temp_capacity){
+        gc.temp_capacity = gc.temp_capacity == 0 ? 64 : gc.temp_capacity * 2;
+        gc.temp_roots = (Value*)heapReallocate(gc.temp_roots, sizeof(Value) * gc.temp_capacity, HEAP_RUNTIME);
+    }
+    if (IS_OBJ(value) && isYoung(AS_OBJ(value)) && gc.temp_count < nursery.young_temp_low){
+        nursery.young_temp_low = gc.temp_count;
+    }
+    gc.temp_roots[gc.temp_count++] = value;
+}
+
+void markObject(Object* object){
+    if (object == NULL || object->mark_epoch == gc.epoch || object->mark_epoch == GC_PINNED) return;
+    object->mark_epoch = gc.epoch;
+    // 로프는 한쪽으로 매우 깊어질 수 있으므로 재귀 대신 회색 스택에 쌓는다
+    if (gc.gray_count == gc.gray_capacity){
+        gc.gray_capacity = gc.gray_capacity == 0 ? 64 : gc.gray_capacity * 2;
+        gc.gray = (Object**)heapReallocate(gc.gray, sizeof(Object*) * gc.gray_capacity, HEAP_RUNTIME);
+    }
+    gc.gray[gc.gray_count++] = object;
+}
+
+void markValue(Value value){
+    if (IS_OBJ(value)) markObject(AS_OBJ(value));
+}
+
+void markEnvironment(Environment* env){
+    while (env != NULL && env->mark_epoch != gc.epoch){
+        env->mark_epoch = gc.epoch;
+        for (unsigned int i = 0; i < env->values.capacity; i++){
+            Entry* entry = &env->values.entries[i];
+            if (entry->key == NULL) continue;
+            markObject(entry->key);
+            markValue(entry->value);
+        }
+        env = env->enclosing;
+    }
+}
+
+void markRoots(Interpreter* interpreter){
+    markEnvironment(interpreter->globals);
+    markGlobalTable();
+    for (Value* slot = vm.stack; slot < vm.stack_top; slot++){
+        markValue(*slot);
+    }
+    markSlotStack();
+    markEnvironment(interpreter->environment);
+    for (size_t i = 0; i < gc.env_root_count; i++){
+        markEnvironment(gc.env_roots[i]);
+    }
+    for (size_t i = 0; i < gc.temp_count; i++){
+        markValue(gc.temp_roots[i]);
+    }
+    markValue(global_return_value);
+    if (interpreter->tail_calling){
+        markValue(interpreter->tail_callee);
+        for (int i = 0; i < interpreter->tail_arg_count; i++) markValue(interpreter->tail_arguments[i]);
+    }
+    for (int i = 0; i < interpreter->cse_slot_count; i++){
+        markValue(interpreter->cse_slots[i]);
+    }
+    if (gc.memo_functions){
+        for (int i = 0; i < gc.memo_functions->count; i++){
+            MemoTable* memo = ((Element*)getElement(gc.memo_functions, i))->data.function_stmt->memo;
+            for (int j = 0; j < memo->count; j++){
+                for (int k = 0; k < memo->arity; k++){
+                    markValue(memo->entries[j].arguments[k]);
+                }
+                markValue(memo->entries[j].result);
+            }
+        }
+    }
+}
+
+void traceReferences(){
+    while (gc.gray_count > 0){
+        Object* object = gc.gray[--gc.gray_count];
+        if (object->type == ROPE){
+            RopeValue* rope = (RopeValue*)object->value;
+            markObject(rope->left);
+            markObject(rope->right);
+            markObject(rope->flat);
+        }
+    }
+}
+
+void removeWhiteStrings(){
+    // 인턴 테이블은 문자열을 붙잡지 않으므로, 회수될 문자열은 여기서 먼저 지운다
+    for (size_t i = 0; i < intern_table.capacity; i++){
+        Object* object = intern_table.slots[i];
+        if (object == NULL || object == INTERN_TOMBSTONE) continue;
+        if (object->mark_epoch != gc.epoch && object->mark_epoch != GC_PINNED){
+            intern_table.slots[i] = INTERN_TOMBSTONE;
+        }
+    }
+}
+
+void sweep(){
+    Object** link = &gc.objects;
+    while (*link != NULL){
+        Object* object = *link;
+        if (object->mark_epoch == gc.epoch){
+            link = &object->next;
+            continue;
+        }
+        *link = object->next;
+        size_t size = objectSize(object);
+        gc.bytes_allocated -= size;
+        gc.bytes_freed += size;
+        if (object->type == STRING){
+            heapFree(object);
+        } else {
+            if (object->type == FUN) slabFree(object->value);
+            slabFree(object);
+        }
+    }
+
+    Environment** env_link = &gc.environments;
+    while (*env_link != NULL){
+        Environment* env = *env_link;
+        if (env->mark_epoch == gc.epoch){
+            env_link = &env->gc_next;
+            continue;
+        }
+        *env_link = env->gc_next;
+        gc.bytes_allocated -= sizeof(Environment);
+        gc.bytes_freed += sizeof(Environment);
+        releaseEnvironmentEntries(env);
+        slabFree(env);
+    }
+}
+
+void collectGarbage(Interpreter* interpreter){
+    clock_t start = clock();
+    gc.epoch++;
+    if (gc.epoch == GC_PINNED) gc.epoch = 1;
+
+    markRoots(interpreter);
+    traceReferences();
+    removeWhiteStrings();
+    sweep();
+
+    size_t next_gc = (size_t)(gc.bytes_allocated * gc.growth);
+    gc.next_gc = next_gc > gc.threshold ? next_gc : gc.threshold;
+    // 예산이 있으면 남은 여유의 절반을 쓸 때마다 수집해서, 회수할 수 있는 쓰레기 때문에 한도에 걸리지 않게 한다
+    if (heap.limit) heap.collect_at = heap.total + (heap.limit - heap.total) / 2;
+
+    double pause = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    gc.collections++;
+    gc.total_pause += pause;
+    if (pause > gc.max_pause) gc.max_pause = pause;
+}
+
+void printGcStats(){
+    fprintf(stderr, "[gc] %ld collections, %.3f ms total pause (%.3f ms max), %zu bytes freed, %zu bytes live\n",
+            gc.collections, gc.total_pause, gc.max_pause, gc.bytes_freed, gc.bytes_allocated);
+    fprintf(stderr, "[gc] nursery: %ld allocations, %ld promoted, %ld resets\n",
+            nursery.allocations, nursery.promotions, nursery.resets);
+}
+
+void* allocateYoung(size_t size){
+    if (!gc.enabled || nursery.disabled) return NULL;
+    if (nursery.start == NULL){
+        nursery.start = (char*)heapAllocate(NURSERY_SIZE, HEAP_VALUES);
+        nursery.top = nursery.start;
+        nursery.end = nursery.start + NURSERY_SIZE;
+    }
+    // 가득 찼는데 비울 수 없으면 힙에 바로 할당한다
+    if (nursery.top + size > nursery.end) return NULL;
+    void* pointer = nursery.top;
+    nursery.top += size;
+    nursery.allocations++;
+    return pointer;
+}
+
+int isYoung(Object* object){
+    return (char*)object >= nursery.start && (char*)object < nursery.end;
+}
+
+Object* promoteObject(Object* object){
+    if (object == NULL || !isYoung(object)) return object;
+    if (object->next) return object->next;
+
+    // nursery에는 로프만 있고, 자식 로프는 같은 식 안에서 만들어졌으므로 깊이가 얕다
+    RopeValue* young = (RopeValue*)object->value;
+    Object* promoted = (Object*)slabAllocate(&rope_pool);
+    if (!promoted) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    RopeValue* rope = (RopeValue*)(promoted + 1);
+    rope->length = young->length;
+    rope->left = promoteObject(young->left);
+    rope->right = promoteObject(young->right);
+    rope->flat = young->flat;
+    promoted->type = ROPE;
+    promoted->value = rope;
+    trackObject(promoted);
+
+    object->next = promoted;
+    nursery.promotions++;
+    return promoted;
+}
+
+Value promoteValue(Value value){
+    if (IS_OBJ(value) && isYoung(AS_OBJ(value))) return OBJ_VAL(promoteObject(AS_OBJ(value)));
+    return value;
+}
+
+void resetNursery(){
+    nursery.top = nursery.start;
+    nursery.young_temp_low = SIZE_MAX;
+    nursery.resets++;
+}
+
+void* slabAllocate(SlabPool* pool){
+    heapGrow(pool->category, pool->object_size);
+    if (pool->free_list == NULL){
+        Slab* slab = (Slab*)aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+        if (!slab) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        slab->pool = pool;
+        slab->live = 0;
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->slab_count++;
+
+        // 낮은 주소부터 나가도록 뒤에서부터 free list에 넣는다
+        size_t capacity = slabCapacity(pool);
+        for (size_t i = capacity; i > 0; i--){
+            void** slot = (void**)((char*)slab + SLAB_HEADER_SIZE + (i - 1) * pool->object_size);
+            *slot = pool->free_list;
+            pool->free_list = slot;
+        }
+    }
+    void** slot = (void**)pool->free_list;
+    pool->free_list = *slot;
+    Slab* slab = (Slab*)((uintptr_t)slot & ~(uintptr_t)(SLAB_SIZE - 1));
+    slab->live++;
+    pool->live++;
+    return slot;
+}
+
+void slabFree(void* pointer){
+    Slab* slab = (Slab*)((uintptr_t)pointer & ~(uintptr_t)(SLAB_SIZE - 1));
+    SlabPool* pool = slab->pool;
+    heapShrink(pool->category, pool->object_size);
+    *(void**)pointer = pool->free_list;
+    pool->free_list = pointer;
+    slab->live--;
+    pool->live--;
+}
+
+size_t slabCapacity(SlabPool* pool){
+    return (SLAB_SIZE - SLAB_HEADER_SIZE) / pool->object_size;
+}
+
+void printSlabStats(){
+    SlabPool* pools[] = {&environment_pool, &function_object_pool, &lox_function_pool, &rope_pool};
+    for (size_t i = 0; i < sizeof(pools) / sizeof(pools[0]); i++){
+        SlabPool* pool = pools[i];
+        size_t capacity = slabCapacity(pool);
+        size_t total = capacity * pool->slab_count;
+        // slab별 점유율 분포: 비어 있음, ~25%, ~50%, ~75%, ~100% 미만, 가득 참
+        size_t buckets[6] = {0};
+        for (Slab* slab = pool->slabs; slab != NULL; slab = slab->next){
+            if (slab->live == 0) buckets[0]++;
+            else if (slab->live == capacity) buckets[5]++;
+            else buckets[1 + (slab->live * 4 - 1) / capacity]++;
+        }
+        fprintf(stderr, "[slab] %s: %zu B x %zu/slab, %zu slabs, %zu/%zu live (%.1f%%), per-slab empty %zu, <=25%% %zu, <=50%% %zu, <=75%% %zu, <100%% %zu, full %zu\n",
+                pool->name, pool->object_size, capacity, pool->slab_count, pool->live, total,
+                total ? 100.0 * pool->live / total : 0.0,
+                buckets[0], buckets[1], buckets[2], buckets[3], buckets[4], buckets[5]);
+    }
+}
+
+void heapGrow(HeapCategory category, size_t size){
+    if (heap.limit && heap.total + size > heap.limit) heapLimitExceeded(size);
+    heap.total += size;
+    heap.live[category] += size;
+    if (heap.live[category] > heap.peak[category]) heap.peak[category] = heap.live[category];
+    if (heap.total > heap.peak_total) heap.peak_total = heap.total;
+}
+
+void heapShrink(HeapCategory category, size_t size){
+    heap.total -= size;
+    heap.live[category] -= size;
+}
+
+void* heapAllocate(size_t size, HeapCategory category){
+    heapGrow(category, size);
+    HeapHeader* header = (HeapHeader*)malloc(sizeof(HeapHeader) + size);
+    if (!header) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    header->info.size = size;
+    header->info.category = category;
+    return header + 1;
+}
+
+void* heapCallocate(size_t count, size_t size, HeapCategory category){
+    void* pointer = heapAllocate(count * size, category);
+    memset(pointer, 0, count * size);
+    return pointer;
+}
+
+void* heapReallocate(void* pointer, size_t size, HeapCategory category){
+    if (pointer == NULL) return heapAllocate(size, category);
+    HeapHeader* header = (HeapHeader*)pointer - 1;
+    size_t old_size = header->info.size;
+    category = header->info.category;
+    if (size > old_size) heapGrow(category, size - old_size);
+    else heapShrink(category, old_size - size);
+
+    header = (HeapHeader*)realloc(header, sizeof(HeapHeader) + size);
+    if (!header) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    header->info.size = size;
+    return header + 1;
+}
+
+char* heapStrdup(const char* string, HeapCategory category){
+    size_t size = strlen(string) + 1;
+    char* copy = (char*)heapAllocate(size, category);
+    memcpy(copy, string, size);
+    return copy;
+}
+
+void heapFree(void* pointer){
+    if (pointer == NULL) return;
+    HeapHeader* header = (HeapHeader*)pointer - 1;
+    heapShrink(header->info.category, header->info.size);
+    free(header);
+}
+
+void heapLimitExceeded(size_t size){
+    fprintf(stderr, "Heap limit exceeded: allocating %zu bytes with %zu of %zu bytes in use.\n", size, heap.total, heap.limit);
+    if (heap_stats_flag) printHeapStats();
+    exit(70);
+}
+
+void printHeapStats(){
+    fprintf(stderr, "[heap] %zu bytes live, %zu bytes peak", heap.total, heap.peak_total);
+    if (heap.limit) fprintf(stderr, ", limit %zu bytes", heap.limit);
+    fprintf(stderr, "\n");
+    for (int i = 0; i < HEAP_CATEGORY_COUNT; i++){
+        fprintf(stderr, "[heap] %-12s %10zu live %10zu peak\n", HeapCategoryStrs[i], heap.live[i], heap.peak[i]);
+    }
+}
+
+Chunk* createChunk(){
+    Chunk* chunk = (Chunk*)heapCallocate(1, sizeof(Chunk), HEAP_BYTECODE);
+    return chunk;
+}
+
+void writeChunk(Chunk* chunk, uint8_t byte, int line){
+    if (chunk->count == chunk->capacity){
+        chunk->capacity = chunk->capacity == 0 ? 64 : chunk->capacity * 2;
+        chunk->code = (uint8_t*)heapReallocate(chunk->code, chunk->capacity, HEAP_BYTECODE);
+        chunk->lines = (int*)heapReallocate(chunk->lines, sizeof(int) * chunk->capacity, HEAP_BYTECODE);
+    }
+    chunk->code[chunk->count] = byte;
+    chunk->lines[chunk->count] = line;
+    chunk->count++;
+}
+
+int addConstant(Compiler* compiler, Value value){
+    Chunk* chunk = compiler->chunk;
+    // 인턴된 문자열과 숫자는 비트가 같으면 같은 상수다
+    for (int i = 0; i < chunk->constant_count; i++){
+        if (chunk->constants[i] == value) return i;
+    }
+    if (chunk->constant_count > UINT16_MAX) compileError(compiler, "Too many constants in one chunk.");
+    if (chunk->constant_count == chunk->constant_capacity){
+        chunk->constant_capacity = chunk->constant_capacity == 0 ? 8 : chunk->constant_capacity * 2;
+        chunk->constants = (Value*)heapReallocate(chunk->constants, sizeof(Value) * chunk->constant_capacity, HEAP_BYTECODE);
+    }
+    chunk->constants[chunk->constant_count] = value;
+    return chunk->constant_count++;
+}
+
+int addGlobal(Compiler* compiler, Object* name){
+    int slot = globalSlot(name);
+    if (slot > UINT16_MAX) compileError(compiler, "Too many global variables.");
+    return slot;
+}
+
+int addChunkFunction(Compiler* compiler, Function* function){
+    Chunk* chunk = compiler->chunk;
+    if (chunk->function_count > UINT16_MAX) compileError(compiler, "Too many functions in one chunk.");
+    if (chunk->function_count == chunk->function_capacity){
+        chunk->function_capacity = chunk->function_capacity == 0 ? 4 : chunk->function_capacity * 2;
+        chunk->functions = (Function**)heapReallocate(chunk->functions, sizeof(Function*) * chunk->function_capacity, HEAP_BYTECODE);
+    }
+    chunk->functions[chunk->function_count] = function;
+    return chunk->function_count++;
+}
+
+void compileError(Compiler* compiler, char* message){
+    fprintf(stderr, "[line %d] Error: %s\n", compiler->line, message);
+    exit(65);
+}
+
+void emitByte(Compiler* compiler, uint8_t byte){
+    writeChunk(compiler->chunk, byte, compiler->line);
+}
+
+void emitOp(Compiler* compiler, OpCode op, int stack_effect){
+    emitByte(compiler, op);
+    compiler->stack_depth += stack_effect;
+    if (compiler->stack_depth > compiler->chunk->max_stack) compiler->chunk->max_stack = compiler->stack_depth;
+}
+
+void emitShort(Compiler* compiler, int operand){
+    emitByte(compiler, (operand >> 8) & 0xff);
+    emitByte(compiler, operand & 0xff);
+}
+
+int emitJump(Compiler* compiler, OpCode op){
+    emitOp(compiler, op, 0);
+    emitShort(compiler, 0xffff);
+    return compiler->chunk->count - 2;
+}
+
+void patchJump(Compiler* compiler, int offset){
+    int jump = compiler->chunk->count - offset - 2;
+    if (jump > UINT16_MAX) compileError(compiler, "Too much code to jump over.");
+    compiler->chunk->code[offset] = (jump >> 8) & 0xff;
+    compiler->chunk->code[offset + 1] = jump & 0xff;
+}
+
+void emitLoop(Compiler* compiler, int loop_start){
+    emitOp(compiler, OP_LOOP, 0);
+    int offset = compiler->chunk->count - loop_start + 2;
+    if (offset > UINT16_MAX) compileError(compiler, "Loop body too large.");
+    emitShort(compiler, offset);
+}
+
+int resolveLocal(Compiler* compiler, Object* name){
+    // 나중에 선언된 같은 이름이 앞의 것을 가린다
+    for (int i = compiler->local_count - 1; i >= 0; i--){
+        if (compiler->locals[i].name == name) return i;
+    }
+    return -1;
+}
+
+int declareLocal(Compiler* compiler, Object* name){
+    if (compiler->local_count > UINT16_MAX) compileError(compiler, "Too many local variables in function.");
+    if (compiler->local_count == compiler->local_capacity){
+        compiler->local_capacity = compiler->local_capacity == 0 ? 8 : compiler->local_capacity * 2;
+        compiler->locals = (Local*)heapReallocate(compiler->locals, sizeof(Local) * compiler->local_capacity, HEAP_BYTECODE);
+    }
+    compiler->locals[compiler->local_count].name = name;
+    compiler->locals[compiler->local_count].depth = compiler->scope_depth;
+    if (compiler->local_count + 1 > compiler->slot_count) compiler->slot_count = compiler->local_count + 1;
+    return compiler->local_count++;
+}
+
+void endScope(Compiler* compiler, int local_count){
+    // 블록을 나가면 슬롯을 다음 블록이 다시 쓴다. 남은 값은 같은 슬롯에 선언이 다시 실행되기 전에는 읽히지 않는다
+    compiler->scope_depth--;
+    compiler->local_count = local_count;
+}
+
+void compileExpr(Compiler* compiler, Expr* expr){
+    if (expr->accept == ExprLiteralAccept){
+        ExprLiteral* literal = (ExprLiteral*)expr;
+        switch (literal->type){
+            case NIL: emitOp(compiler, OP_NIL, 1); return;
+            case TRUE: emitOp(compiler, OP_TRUE, 1); return;
+            case FALSE: emitOp(compiler, OP_FALSE, 1); return;
+            default:
+                emitOp(compiler, OP_CONSTANT, 1);
+                emitShort(compiler, addConstant(compiler, literal->constant));
+                return;
+        }
+    }
+    if (expr->accept == ExprGroupingAccept){
+        compileExpr(compiler, ((ExprGrouping*)expr)->expression);
+        return;
+    }
+    if (expr->accept == ExprVariableAccept){
+        Token* name = ((Variable*)expr)->name;
+        compiler->line = name->line;
+        int slot = resolveLocal(compiler, name->name);
+        if (slot >= 0){
+            emitOp(compiler, OP_GET_LOCAL, 1);
+            emitShort(compiler, slot);
+        } else {
+            emitOp(compiler, OP_GET_GLOBAL, 1);
+            emitShort(compiler, addGlobal(compiler, name->name));
+        }
+        return;
+    }
+    if (expr->accept == ExprAssignAccept){
+        Assign* assign = (Assign*)expr;
+        compileExpr(compiler, assign->value);
+        compiler->line = assign->name->line;
+        int slot = resolveLocal(compiler, assign->name->name);
+        if (slot >= 0){
+            emitOp(compiler, OP_SET_LOCAL, 0);
+            emitShort(compiler, slot);
+        } else {
+            emitOp(compiler, OP_SET_GLOBAL, 0);
+            emitShort(compiler, addGlobal(compiler, assign->name->name));
+        }
+        return;
+    }
+    if (expr->accept == ExprLogicalAccept){
+        Logical* logical = (Logical*)expr;
+        compileExpr(compiler, logical->left);
+        compiler->line = logical->operator->line;
+        if (logical->operator->type == OR){
+            int else_jump = emitJump(compiler, OP_JUMP_IF_FALSE);
+            int end_jump = emitJump(compiler, OP_JUMP);
+            patchJump(compiler, else_jump);
+            emitOp(compiler, OP_POP, -1);
+            compileExpr(compiler, logical->right);
+            patchJump(compiler, end_jump);
+        } else {
+            int end_jump = emitJump(compiler, OP_JUMP_IF_FALSE);
+            emitOp(compiler, OP_POP, -1);
+            compileExpr(compiler, logical->right);
+            patchJump(compiler, end_jump);
+        }
+        return;
+    }
+    if (isUnaryExpr(expr)){
+        ExprUnary* unary = (ExprUnary*)expr;
+        compileExpr(compiler, unary->right);
+        compiler->line = unary->operator->line;
+        emitOp(compiler, unary->operator->type == MINUS ? OP_NEGATE : OP_NOT, 0);
+        return;
+    }
+    if (isBinaryExpr(expr)){
+        ExprBinary* binary = (ExprBinary*)expr;
+        compileExpr(compiler, binary->left);
+        compileExpr(compiler, binary->right);
+        compiler->line = binary->operator->line;
+        OpCode op;
+        switch (binary->operator->type){
+            case PLUS: op = OP_ADD; break;
+            case MINUS: op = OP_SUBTRACT; break;
+            case STAR: op = OP_MULTIPLY; break;
+            case SLASH: op = OP_DIVIDE; break;
+            case GREATER: op = OP_GREATER; break;
+            case GREATER_EQUAL: op = OP_GREATER_EQUAL; break;
+            case LESS: op = OP_LESS; break;
+            case LESS_EQUAL: op = OP_LESS_EQUAL; break;
+            case BANG_EQUAL: op = OP_NOT_EQUAL; break;
+            default: op = OP_EQUAL; break;
+        }
+        emitOp(compiler, op, -1);
+        return;
+    }
+    if (expr->accept == ExprCallAccept){
+        Call* call = (Call*)expr;
+        compileExpr(compiler, call->callee);
+        for (int i = 0; i < call->arguments->count; i++){
+            Element* element = getElement(call->arguments, i);
+            compileExpr(compiler, element->data.expr_stmt->expression);
+        }
+        compiler->line = call->paren->line;
+        // 인자 수는 한 바이트에 담는다
+        if (call->arguments->count > MAX_CALL_ARGUMENTS) compileError(compiler, "Can't have more than 255 arguments.");
+        emitOp(compiler, OP_CALL, -(int)call->arguments->count);
+        emitByte(compiler, call->arguments->count);
+        return;
+    }
+    compileError(compiler, "Unsupported expression.");
+}
+
+void compileStmt(Compiler* compiler, Stmt* stmt){
+    if (stmt->accept == PrintStmtAccept){
+        compileExpr(compiler, ((Print*)stmt)->expression);
+        emitOp(compiler, OP_PRINT, -1);
+        return;
+    }
+    if (stmt->accept == ExpressionStmtAccept){
+        compileExpr(compiler, ((Expression*)stmt)->expression);
+        emitOp(compiler, OP_POP, -1);
+        return;
+    }
+    if (stmt->accept == VarStmtAccept){
+        Var* var_stmt = (Var*)stmt;
+        // 초기값은 새 이름이 보이기 전에 평가한다 (var a = a;)
+        compileExpr(compiler, var_stmt->initializer);
+        compiler->line = var_stmt->name->line;
+        if (compiler->scope_depth == 0){
+            emitOp(compiler, OP_DEFINE_GLOBAL, -1);
+            emitShort(compiler, addGlobal(compiler, var_stmt->name->name));
+        } else {
+            emitOp(compiler, OP_DEFINE_LOCAL, -1);
+            emitShort(compiler, declareLocal(compiler, var_stmt->name->name));
+        }
+        return;
+    }
+    if (stmt->accept == BlockStmtAccept){
+        int local_count = compiler->local_count;
+        compiler->scope_depth++;
+        compileStatements(compiler, ((Block*)stmt)->statements);
+        endScope(compiler, local_count);
+        return;
+    }
+    if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        compileExpr(compiler, if_stmt->condition);
+        int else_jump = emitJump(compiler, OP_JUMP_IF_FALSE);
+        emitOp(compiler, OP_POP, -1);
+        compileStmt(compiler, if_stmt->thenBranch);
+        int end_jump = emitJump(compiler, OP_JUMP);
+        patchJump(compiler, else_jump);
+        compiler->stack_depth++; // else 쪽으로 오면 조건 값이 아직 남아 있다
+        emitOp(compiler, OP_POP, -1);
+        if (if_stmt->elseBranch != NULL) compileStmt(compiler, if_stmt->elseBranch);
+        patchJump(compiler, end_jump);
+        return;
+    }
+    if (stmt->accept == WhileStmtAccept){
+        While* while_stmt = (While*)stmt;
+        int loop_start = compiler->chunk->count;
+        compileExpr(compiler, while_stmt->condition);
+        int exit_jump = emitJump(compiler, OP_JUMP_IF_FALSE);
+        emitOp(compiler, OP_POP, -1);
+        compileStmt(compiler, while_stmt->body);
+        emitLoop(compiler, loop_start);
+        patchJump(compiler, exit_jump);
+        compiler->stack_depth++;
+        emitOp(compiler, OP_POP, -1);
+        return;
+    }
+    if (stmt->accept == FunctionStmtAccept){
+        Function* function = (Function*)stmt;
+        function->chunk = compileFunction(function);
+        compiler->line = function->name->line;
+        emitOp(compiler, OP_FUNCTION, 1);
+        emitShort(compiler, addChunkFunction(compiler, function));
+        if (compiler->scope_depth == 0){
+            emitOp(compiler, OP_DEFINE_GLOBAL, -1);
+            emitShort(compiler, addGlobal(compiler, function->name->name));
+        } else {
+            emitOp(compiler, OP_DEFINE_LOCAL, -1);
+            emitShort(compiler, declareLocal(compiler, function->name->name));
+        }
+        return;
+    }
+    if (stmt->accept == ReturnStmtAccept){
+        Return* return_stmt = (Return*)stmt;
+        if (isTailCall(return_stmt->value)){
+            // 꼬리 호출은 지금 프레임을 다시 쓴다. 네이티브 함수면 보통 호출처럼 결과를 남기고 뒤의 OP_RETURN으로 간다
+            Call* call = (Call*)return_stmt->value;
+            compileExpr(compiler, call->callee);
+            for (int i = 0; i < call->arguments->count; i++){
+                Element* element = getElement(call->arguments, i);
+                compileExpr(compiler, element->data.expr_stmt->expression);
+            }
+            compiler->line = call->paren->line;
+            emitOp(compiler, OP_TAIL_CALL, -(int)call->arguments->count);
+            emitByte(compiler, call->arguments->count);
+        } else if (return_stmt->value != NULL){
+            compileExpr(compiler, return_stmt->value);
+        } else {
+            emitOp(compiler, OP_NIL, 1);
+        }
+        compiler->line = return_stmt->keyword->line;
+        emitOp(compiler, OP_RETURN, -1);
+        return;
+    }
+}
+
+void compileStatements(Compiler* compiler, Array* statements){
+    for (int i = 0; i < statements->count; i++){
+        compileStmt(compiler, elementStmt(getElement(statements, i)));
+    }
+}
+
+Chunk* compileFunction(Function* function){
+    Compiler compiler = {createChunk(), NULL, 0, 0, 0, 1, 0, function->name->line};
+    // 본문은 인자와 같은 환경에서 실행되므로 같은 깊이에 선언한다
+    for (int i = 0; i < function->params->count; i++){
+        Element* element = getElement(function->params, i);
+        declareLocal(&compiler, element->data.token->name);
+    }
+    compileStatements(&compiler, function->body);
+    emitOp(&compiler, OP_NIL, 1);
+    emitOp(&compiler, OP_RETURN, -1);
+    compiler.chunk->slot_count = compiler.slot_count;
+    heapFree(compiler.locals);
+    return compiler.chunk;
+}
+
+Chunk* compileScript(Array* statements){
+    Compiler compiler = {createChunk(), NULL, 0, 0, 0, 0, 0, 1};
+    compileStatements(&compiler, statements);
+    emitOp(&compiler, OP_NIL, 1);
+    emitOp(&compiler, OP_RETURN, -1);
+    compiler.chunk->slot_count = compiler.slot_count;
+    heapFree(compiler.locals);
+    return compiler.chunk;
+}
+
+void vmRuntimeError(Chunk* chunk, uint8_t* ip, char* message){
+    fprintf(stderr, "%s\n [line %d ]", message, chunk->lines[ip - chunk->code - 1]);
+    exit(70);
+}
+
+void ensureVmStack(size_t needed){
+    if (needed <= vm.stack_capacity) return;
+    Value* old_stack = vm.stack;
+    size_t capacity = vm.stack_capacity == 0 ? VM_STACK_INITIAL : vm.stack_capacity;
+    while (capacity < needed) capacity *= 2;
+    vm.stack = (Value*)heapReallocate(vm.stack, sizeof(Value) * capacity, HEAP_RUNTIME);
+    vm.stack_capacity = capacity;
+    // 스택이 옮겨졌으면 프레임의 슬롯 포인터도 같이 옮긴다
+    for (int i = 0; i < vm.frame_count; i++){
+        vm.frames[i].slots = vm.stack + (vm.frames[i].slots - old_stack);
+    }
+}
+
+void runVm(Interpreter* interpreter, Chunk* script){
+    vm.interpreter = interpreter;
+    vm.frame_capacity = VM_FRAMES_INITIAL;
+    vm.frames = (CallFrame*)heapAllocate(sizeof(CallFrame) * vm.frame_capacity, HEAP_RUNTIME);
+    ensureVmStack(1 + script->slot_count + script->max_stack);
+
+    // 0번 슬롯은 호출된 함수 자리, 스크립트에는 없으므로 nil을 둔다
+    vm.stack[0] = NIL_VAL;
+    CallFrame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = script;
+    frame->slots = vm.stack + 1;
+    for (int i = 0; i < script->slot_count; i++) frame->slots[i] = NIL_VAL;
+
+    // 실행 중인 프레임의 상태는 지역 변수에 두고, 호출과 수집할 때만 저장한다
+    Chunk* chunk = script;
+    uint8_t* ip = script->code;
+    Value* slots = frame->slots;
+    Value* sp = slots + script->slot_count;
+
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define VM_SAFE_POINT() \
+    do { \
+        if (gc.bytes_allocated > gc.next_gc || (heap.limit && heap.total > heap.collect_at)){ \
+            vm.stack_top = sp; \
+            collectGarbage(interpreter); \
+        } \
+    } while (0)
+#define VM_NUMBER_BINARY(make, operator) \
+    do { \
+        Value right = sp[-1]; \
+        Value left = sp[-2]; \
+        if (!IS_NUMBER(left) || !IS_NUMBER(right)) vmRuntimeError(chunk, ip, "Operands must be numbers."); \
+        sp[-2] = make(AS_NUMBER(left) operator AS_NUMBER(right)); \
+        sp--; \
+    } while (0)
+
+#ifdef VM_COMPUTED_GOTO
+    static void* dispatch_table[] = {
+        [OP_CONSTANT] = &&op_constant, [OP_NIL] = &&op_nil, [OP_TRUE] = &&op_true, [OP_FALSE] = &&op_false,
+        [OP_POP] = &&op_pop, [OP_GET_LOCAL] = &&op_get_local, [OP_SET_LOCAL] = &&op_set_local,
+        [OP_DEFINE_LOCAL] = &&op_define_local, [OP_GET_GLOBAL] = &&op_get_global,
+        [OP_SET_GLOBAL] = &&op_set_global, [OP_DEFINE_GLOBAL] = &&op_define_global,
+        [OP_EQUAL] = &&op_equal, [OP_NOT_EQUAL] = &&op_not_equal, [OP_GREATER] = &&op_greater,
+        [OP_GREATER_EQUAL] = &&op_greater_equal, [OP_LESS] = &&op_less, [OP_LESS_EQUAL] = &&op_less_equal,
+        [OP_ADD] = &&op_add, [OP_SUBTRACT] = &&op_subtract, [OP_MULTIPLY] = &&op_multiply,
+        [OP_DIVIDE] = &&op_divide, [OP_NOT] = &&op_not, [OP_NEGATE] = &&op_negate, [OP_PRINT] = &&op_print,
+        [OP_JUMP] = &&op_jump, [OP_JUMP_IF_FALSE] = &&op_jump_if_false, [OP_LOOP] = &&op_loop,
+        [OP_CALL] = &&op_call, [OP_TAIL_CALL] = &&op_tail_call, [OP_FUNCTION] = &&op_function,
+        [OP_RETURN] = &&op_return,
+    };
+#define VM_CASE(op, label) label:
+#define VM_DISPATCH() goto *dispatch_table[*ip++]
+    VM_DISPATCH();
+#else
+#define VM_CASE(op, label) case op:
+#define VM_DISPATCH() continue
+    for (;;) switch (*ip++) {
+#endif
+    VM_CASE(OP_CONSTANT, op_constant){
+        *sp++ = chunk->constants[READ_SHORT()];
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_NIL, op_nil){
+        *sp++ = NIL_VAL;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_TRUE, op_true){
+        *sp++ = TRUE_VAL;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_FALSE, op_false){
+        *sp++ = FALSE_VAL;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_POP, op_pop){
+        sp--;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_GET_LOCAL, op_get_local){
+        *sp++ = slots[READ_SHORT()];
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_SET_LOCAL, op_set_local){
+        slots[READ_SHORT()] = sp[-1];
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_DEFINE_LOCAL, op_define_local){
+        slots[READ_SHORT()] = *--sp;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_GET_GLOBAL, op_get_global){
+        int slot = READ_SHORT();
+        *sp = global_table.values[slot];
+        if (*sp == UNDEFINED_VAL){
+            char message[128];
+            snprintf(message, sizeof(message), "Undefined variable '%s'.", ((StringValue*)global_table.names[slot]->value)->string);
+            vmRuntimeError(chunk, ip, message);
+        }
+        sp++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_SET_GLOBAL, op_set_global){
+        int slot = READ_SHORT();
+        if (global_table.values[slot] == UNDEFINED_VAL){
+            char message[128];
+            snprintf(message, sizeof(message), "Undefined variable '%s'.", ((StringValue*)global_table.names[slot]->value)->string);
+            vmRuntimeError(chunk, ip, message);
+        }
+        global_table.values[slot] = sp[-1];
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_DEFINE_GLOBAL, op_define_global){
+        defineGlobal(READ_SHORT(), *--sp);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_EQUAL, op_equal){
+        sp[-2] = BOOL_VAL(isEqual(sp[-2], sp[-1]));
+        sp--;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_NOT_EQUAL, op_not_equal){
+        sp[-2] = BOOL_VAL(!isEqual(sp[-2], sp[-1]));
+        sp--;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_GREATER, op_greater){
+        VM_NUMBER_BINARY(BOOL_VAL, >);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_GREATER_EQUAL, op_greater_equal){
+        VM_NUMBER_BINARY(BOOL_VAL, >=);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_LESS, op_less){
+        VM_NUMBER_BINARY(BOOL_VAL, <);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_LESS_EQUAL, op_less_equal){
+        VM_NUMBER_BINARY(BOOL_VAL, <=);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_ADD, op_add){
+        Value right = sp[-1];
+        Value left = sp[-2];
+        if (IS_NUMBER(left) && IS_NUMBER(right)){
+            sp[-2] = NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+        } else if (!plusOperation(left, right, &sp[-2])){
+            vmRuntimeError(chunk, ip, "Operands must be two numbers or two strings.");
+        }
+        sp--;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_SUBTRACT, op_subtract){
+        VM_NUMBER_BINARY(NUMBER_VAL, -);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_MULTIPLY, op_multiply){
+        VM_NUMBER_BINARY(NUMBER_VAL, *);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_DIVIDE, op_divide){
+        VM_NUMBER_BINARY(NUMBER_VAL, /);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_NOT, op_not){
+        sp[-1] = BOOL_VAL(!isTruthy(sp[-1]));
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_NEGATE, op_negate){
+        if (!IS_NUMBER(sp[-1])) vmRuntimeError(chunk, ip, "Operand must be a number.");
+        sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_PRINT, op_print){
+        printf("%s\n", stringify(*--sp));
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_JUMP, op_jump){
+        uint16_t offset = READ_SHORT();
+        ip += offset;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_JUMP_IF_FALSE, op_jump_if_false){
+        uint16_t offset = READ_SHORT();
+        if (!isTruthy(sp[-1])) ip += offset;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_LOOP, op_loop){
+        uint16_t offset = READ_SHORT();
+        ip -= offset;
+        VM_SAFE_POINT();
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_CALL, op_call){
+        int arg_count = *ip++;
+        Value callee = sp[-1 - arg_count];
+        if (!IS_FUNCTION(callee)) vmRuntimeError(chunk, ip, "Can only call functions and classes.");
+        LoxFunction* lox_function = (LoxFunction*)AS_OBJ(callee)->value;
+        Function* declaration = lox_function->declaration;
+        int expected = declaration ? declaration->params->count : lox_function->base.arity((LoxCallable*)lox_function);
+        if (arg_count != expected){
+            char message[64];
+            snprintf(message, sizeof(message), "Expected %d arguments but got %d.", expected, arg_count);
+            vmRuntimeError(chunk, ip, message);
+        }
+        if (declaration == NULL){
+            // 네이티브 함수는 트리 워커와 같은 호출 규약을 쓰므로 VM 스택의 인자를 그대로 넘긴다
+            Value result = lox_function->base.call(lox_function, interpreter, sp - arg_count, arg_count);
+            sp -= arg_count + 1;
+            *sp++ = result;
+            VM_DISPATCH();
+        }
+
+        // 0번 프레임은 스크립트이므로 frame_count는 진행 중인 호출 수보다 하나 많다
+        if (vm.frame_count > max_call_depth) vmRuntimeError(chunk, ip, "Stack overflow.");
+        Chunk* callee_chunk = declaration->chunk;
+        frame->ip = ip;
+        if (vm.frame_count == vm.frame_capacity){
+            vm.frame_capacity *= 2;
+            vm.frames = (CallFrame*)heapReallocate(vm.frames, sizeof(CallFrame) * vm.frame_capacity, HEAP_RUNTIME);
+        }
+        size_t base = (sp - arg_count) - vm.stack;
+        ensureVmStack(base + callee_chunk->slot_count + callee_chunk->max_stack);
+        frame = &vm.frames[vm.frame_count++];
+        frame->chunk = callee_chunk;
+        frame->slots = vm.stack + base;
+        chunk = callee_chunk;
+        slots = frame->slots;
+        for (int i = arg_count; i < chunk->slot_count; i++) slots[i] = NIL_VAL;
+        sp = slots + chunk->slot_count;
+        ip = chunk->code;
+        VM_SAFE_POINT();
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_TAIL_CALL, op_tail_call){
+        int arg_count = *ip++;
+        Value callee = sp[-1 - arg_count];
+        if (!IS_FUNCTION(callee)) vmRuntimeError(chunk, ip, "Can only call functions and classes.");
+        LoxFunction* lox_function = (LoxFunction*)AS_OBJ(callee)->value;
+        Function* declaration = lox_function->declaration;
+        int expected = declaration ? declaration->params->count : lox_function->base.arity((LoxCallable*)lox_function);
+        if (arg_count != expected){
+            char message[64];
+            snprintf(message, sizeof(message), "Expected %d arguments but got %d.", expected, arg_count);
+            vmRuntimeError(chunk, ip, message);
+        }
+        if (declaration == NULL){
+            Value result = lox_function->base.call(lox_function, interpreter, sp - arg_count, arg_count);
+            sp -= arg_count + 1;
+            *sp++ = result;
+            VM_DISPATCH();
+        }
+
+        // 호출된 함수와 인자를 지금 프레임의 바닥으로 내리고 프레임을 새 함수에 넘긴다
+        Value* callee_slot = sp - arg_count - 1;
+        memmove(slots - 1, callee_slot, sizeof(Value) * (arg_count + 1));
+        Chunk* callee_chunk = declaration->chunk;
+        ensureVmStack((slots - vm.stack) + callee_chunk->slot_count + callee_chunk->max_stack);
+        frame->chunk = callee_chunk;
+        chunk = callee_chunk;
+        slots = frame->slots;
+        for (int i = arg_count; i < chunk->slot_count; i++) slots[i] = NIL_VAL;
+        sp = slots + chunk->slot_count;
+        ip = chunk->code;
+        VM_SAFE_POINT();
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_FUNCTION, op_function){
+        Function* declaration = chunk->functions[READ_SHORT()];
+        LoxFunction* lox_function = createLoxFunction(declaration);
+        *sp++ = OBJ_VAL(createObject(FUN, lox_function));
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_RETURN, op_return){
+        Value result = sp[-1];
+        if (vm.frame_count == 1){
+            vm.stack_top = vm.stack;
+            return;
+        }
+        // 호출된 함수 자리에 반환값을 둔다
+        sp = slots - 1;
+        vm.frame_count--;
+        frame = &vm.frames[vm.frame_count - 1];
+        chunk = frame->chunk;
+        ip = frame->ip;
+        slots = frame->slots;
+        *sp++ = result;
+        VM_DISPATCH();
+    }
+#ifndef VM_COMPUTED_GOTO
+    }
+#endif
+
+#undef READ_SHORT
+#undef VM_SAFE_POINT
+#undef VM_NUMBER_BINARY
+#undef VM_CASE
+#undef VM_DISPATCH
+}
+
+ClosureNode* createClosureNode(Token* token){
+    ClosureNode* node = (ClosureNode*)heapCallocate(1, sizeof(ClosureNode), HEAP_BYTECODE);
+    node->token = token;
+    return node;
+}
+
+Value closureConstant(ClosureNode* self, Value* slots){
+    return self->constant;
+}
+
+Value closureGetLocal(ClosureNode* self, Value* slots){
+    return slots[self->slot];
+}
+
+Value closureGetGlobal(ClosureNode* self, Value* slots){
+    return getGlobal(self->slot, self->token);
+}
+
+Value closureSetLocal(ClosureNode* self, Value* slots){
+    Value value = self->left->eval(self->left, slots);
+    slots[self->slot] = value;
+    return value;
+}
+
+Value closureSetGlobal(ClosureNode* self, Value* slots){
+    Value value = self->left->eval(self->left, slots);
+    setGlobal(self->slot, self->token, value);
+    return value;
+}
+
+Value closureOr(ClosureNode* self, Value* slots){
+    Value left = self->left->eval(self->left, slots);
+    if (isTruthy(left)) return left;
+    return self->right->eval(self->right, slots);
+}
+
+Value closureAnd(ClosureNode* self, Value* slots){
+    Value left = self->left->eval(self->left, slots);
+    if (!isTruthy(left)) return left;
+    return self->right->eval(self->right, slots);
+}
+
+Value closureNot(ClosureNode* self, Value* slots){
+    return BOOL_VAL(!isTruthy(self->left->eval(self->left, slots)));
+}
+
+Value closureNegate(ClosureNode* self, Value* slots){
+    Value right = self->left->eval(self->left, slots);
+    if (!IS_NUMBER(right)) runtimeError(self->token, "Operand must be a number.");
+    return NUMBER_VAL(-AS_NUMBER(right));
+}
+
+// 오른쪽을 평가하는 동안 호출이 일어나 수집될 수 있으므로 왼쪽 값을 잠시 루트로 잡아 둔다
+#define CLOSURE_OPERANDS() \
+    Value left = self->left->eval(self->left, slots); \
+    size_t temp_count = gc.temp_count; \
+    if (IS_OBJ(left)) pushTempRoot(left); \
+    Value right = self->right->eval(self->right, slots); \
+    gc.temp_count = temp_count
+
+#define CLOSURE_NUMBER_BINARY(name, make, operator) \
+    Value name(ClosureNode* self, Value* slots){ \
+        CLOSURE_OPERANDS(); \
+        if (!IS_NUMBER(left) || !IS_NUMBER(right)) runtimeError(self->token, "Operands must be numbers."); \
+        return make(AS_NUMBER(left) operator AS_NUMBER(right)); \
+    }
+
+CLOSURE_NUMBER_BINARY(closureSubtract, NUMBER_VAL, -)
+CLOSURE_NUMBER_BINARY(closureMultiply, NUMBER_VAL, *)
+CLOSURE_NUMBER_BINARY(closureDivide, NUMBER_VAL, /)
+CLOSURE_NUMBER_BINARY(closureGreater, BOOL_VAL, >)
+CLOSURE_NUMBER_BINARY(closureGreaterEqual, BOOL_VAL, >=)
+CLOSURE_NUMBER_BINARY(closureLess, BOOL_VAL, <)
+CLOSURE_NUMBER_BINARY(closureLessEqual, BOOL_VAL, <=)
+
+Value closureAdd(ClosureNode* self, Value* slots){
+    CLOSURE_OPERANDS();
+    if (IS_NUMBER(left) && IS_NUMBER(right)) return NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+    Value result;
+    if (!plusOperation(left, right, &result)) runtimeError(self->token, "Operands must be two numbers or two strings.");
+    return result;
+}
+
+Value closureEqual(ClosureNode* self, Value* slots){
+    CLOSURE_OPERANDS();
+    return BOOL_VAL(isEqual(left, right));
+}
+
+Value closureNotEqual(ClosureNode* self, Value* slots){
+    CLOSURE_OPERANDS();
+    return BOOL_VAL(!isEqual(left, right));
+}
+
+#undef CLOSURE_NUMBER_BINARY
+#undef CLOSURE_OPERANDS
+
+Value closureCall(ClosureNode* self, Value* slots){
+    Value callee = self->left->eval(self->left, slots);
+    size_t temp_count = gc.temp_count;
+    pushTempRoot(callee);
+    int arg_count = self->child_count;
+    Value args[arg_count + 1];
+    for (int i = 0; i < arg_count; i++){
+        args[i] = self->children[i]->eval(self->children[i], slots);
+        pushTempRoot(args[i]);
+    }
+    if (!IS_FUNCTION(callee)) runtimeError(self->token, "Can only call functions and classes.");
+    LoxFunction* lox_function = (LoxFunction*)AS_OBJ(callee)->value;
+    Function* declaration = lox_function->declaration;
+    int expected = declaration ? declaration->params->count : lox_function->base.arity((LoxCallable*)lox_function);
+    if (arg_count != expected){
+        char message[64];
+        snprintf(message, sizeof(message), "Expected %d arguments but got %d.", expected, arg_count);
+        runtimeError(self->token, message);
+    }
+    Value result;
+    if (declaration == NULL){
+        // 네이티브 함수는 트리 워커와 같은 호출 규약을 쓴다
+        result = lox_function->base.call(lox_function, closure_interpreter, args, arg_count);
+    } else {
+        if (closure_interpreter->call_depth >= max_call_depth || stackExhausted()) runtimeError(self->token, "Stack overflow.");
+        closure_interpreter->call_depth++;
+        result = callClosureCode(declaration->closure_code, args, arg_count);
+        closure_interpreter->call_depth--;
+    }
+    gc.temp_count = temp_count;
+    return result;
+}
+
+Value closureFunction(ClosureNode* self, Value* slots){
+    return OBJ_VAL(createObject(FUN, createLoxFunction(self->function)));
+}
+
+int closureExpressionStmt(ClosureNode* self, Value* slots){
+    self->left->eval(self->left, slots);
+    return 0;
+}
+
+int closurePrintStmt(ClosureNode* self, Value* slots){
+    printf("%s\n", stringify(self->left->eval(self->left, slots)));
+    return 0;
+}
+
+int closureDefineLocal(ClosureNode* self, Value* slots){
+    slots[self->slot] = self->left->eval(self->left, slots);
+    return 0;
+}
+
+int closureDefineGlobal(ClosureNode* self, Value* slots){
+    defineGlobal(self->slot, self->left->eval(self->left, slots));
+    return 0;
+}
+
+int closureBlock(ClosureNode* self, Value* slots){
+    for (int i = 0; i < self->child_count; i++){
+        closureSafePoint();
+        ClosureNode* child = self->children[i];
+        if (child->exec(child, slots)) return 1;
+    }
+    return 0;
+}
+
+int closureIf(ClosureNode* self, Value* slots){
+    if (isTruthy(self->left->eval(self->left, slots))) return self->right->exec(self->right, slots);
+    if (self->other != NULL) return self->other->exec(self->other, slots);
+    return 0;
+}
+
+int closureWhile(ClosureNode* self, Value* slots){
+    while (isTruthy(self->left->eval(self->left, slots))){
+        closureSafePoint();
+        if (self->right->exec(self->right, slots)) return 1;
+    }
+    return 0;
+}
+
+int closureReturn(ClosureNode* self, Value* slots){
+    global_return_value = self->left->eval(self->left, slots);
+    return 1;
+}
+
+int closureTailCall(ClosureNode* self, Value* slots){
+    // 함수와 인자만 넘기고 빠져나가면 callClosureCode가 지금 프레임 자리에서 이어서 실행한다
+    Value callee = self->left->eval(self->left, slots);
+    size_t temp_count = gc.temp_count;
+    pushTempRoot(callee);
+    int arg_count = self->child_count;
+    Value args[arg_count + 1];
+    for (int i = 0; i < arg_count; i++){
+        args[i] = self->children[i]->eval(self->children[i], slots);
+        pushTempRoot(args[i]);
+    }
+    LoxCallable* lox_callable = checkCallable(callee, self->token, arg_count);
+    global_return_value = NIL_VAL;
+    if (((LoxFunction*)lox_callable)->declaration == NULL){
+        global_return_value = lox_callable->call(lox_callable, closure_interpreter, args, arg_count);
+    } else {
+        for (int i = 0; i < arg_count; i++) closure_interpreter->tail_arguments[i] = args[i];
+        closure_interpreter->tail_callee = callee;
+        closure_interpreter->tail_arg_count = arg_count;
+        closure_interpreter->tail_calling = 1;
+    }
+    gc.temp_count = temp_count;
+    return 1;
+}
+
+ClosureNode* compileClosureExpr(Compiler* compiler, Expr* expr){
+    if (expr->accept == ExprLiteralAccept){
+        ClosureNode* node = createClosureNode(NULL);
+        node->eval = closureConstant;
+        node->constant = ((ExprLiteral*)expr)->constant;
+        return node;
+    }
+    if (expr->accept == ExprGroupingAccept){
+        return compileClosureExpr(compiler, ((ExprGrouping*)expr)->expression);
+    }
+    if (expr->accept == ExprVariableAccept){
+        Token* name = ((Variable*)expr)->name;
+        ClosureNode* node = createClosureNode(name);
+        node->slot = resolveLocal(compiler, name->name);
+        node->name = name->name;
+        node->eval = node->slot >= 0 ? closureGetLocal : closureGetGlobal;
+        if (node->slot < 0) node->slot = globalSlot(name->name);
+        return node;
+    }
+    if (expr->accept == ExprAssignAccept){
+        Assign* assign = (Assign*)expr;
+        ClosureNode* node = createClosureNode(assign->name);
+        node->left = compileClosureExpr(compiler, assign->value);
+        node->slot = resolveLocal(compiler, assign->name->name);
+        node->name = assign->name->name;
+        node->eval = node->slot >= 0 ? closureSetLocal : closureSetGlobal;
+        if (node->slot < 0) node->slot = globalSlot(assign->name->name);
+        return node;
+    }
+    if (expr->accept == ExprLogicalAccept){
+        Logical* logical = (Logical*)expr;
+        ClosureNode* node = createClosureNode(logical->operator);
+        node->left = compileClosureExpr(compiler, logical->left);
+        node->right = compileClosureExpr(compiler, logical->right);
+        node->eval = logical->operator->type == OR ? closureOr : closureAnd;
+        return node;
+    }
+    if (isUnaryExpr(expr)){
+        ExprUnary* unary = (ExprUnary*)expr;
+        ClosureNode* node = createClosureNode(unary->operator);
+        node->left = compileClosureExpr(compiler, unary->right);
+        node->eval = unary->operator->type == MINUS ? closureNegate : closureNot;
+        return node;
+    }
+    if (isBinaryExpr(expr)){
+        ExprBinary* binary = (ExprBinary*)expr;
+        ClosureNode* node = createClosureNode(binary->operator);
+        node->left = compileClosureExpr(compiler, binary->left);
+        node->right = compileClosureExpr(compiler, binary->right);
+        switch (binary->operator->type){
+            case PLUS: node->eval = closureAdd; break;
+            case MINUS: node->eval = closureSubtract; break;
+            case STAR: node->eval = closureMultiply; break;
+            case SLASH: node->eval = closureDivide; break;
+            case GREATER: node->eval = closureGreater; break;
+            case GREATER_EQUAL: node->eval = closureGreaterEqual; break;
+            case LESS: node->eval = closureLess; break;
+            case LESS_EQUAL: node->eval = closureLessEqual; break;
+            case BANG_EQUAL: node->eval = closureNotEqual; break;
+            default: node->eval = closureEqual; break;
+        }
+        return node;
+    }
+    if (expr->accept == ExprCallAccept){
+        Call* call = (Call*)expr;
+        ClosureNode* node = createClosureNode(call->paren);
+        node->eval = closureCall;
+        node->left = compileClosureExpr(compiler, call->callee);
+        node->child_count = call->arguments->count;
+        node->children = (ClosureNode**)heapAllocate(sizeof(ClosureNode*) * (node->child_count + 1), HEAP_BYTECODE);
+        for (int i = 0; i < node->child_count; i++){
+            Element* element = getElement(call->arguments, i);
+            node->children[i] = compileClosureExpr(compiler, element->data.expr_stmt->expression);
+        }
+        return node;
+    }
+    compileError(compiler, "Unsupported expression.");
+    return NULL;
+}
+
+ClosureNode* compileClosureStmt(Compiler* compiler, Stmt* stmt){
+    if (stmt->accept == PrintStmtAccept){
+        ClosureNode* node = createClosureNode(NULL);
+        node->exec = closurePrintStmt;
+        node->left = compileClosureExpr(compiler, ((Print*)stmt)->expression);
+        return node;
+    }
+    if (stmt->accept == ExpressionStmtAccept){
+        ClosureNode* node = createClosureNode(NULL);
+        node->exec = closureExpressionStmt;
+        node->left = compileClosureExpr(compiler, ((Expression*)stmt)->expression);
+        return node;
+    }
+    if (stmt->accept == VarStmtAccept || stmt->accept == FunctionStmtAccept){
+        Token* name;
+        ClosureNode* node = createClosureNode(NULL);
+        if (stmt->accept == VarStmtAccept){
+            Var* var_stmt = (Var*)stmt;
+            name = var_stmt->name;
+            // 초기값은 새 이름이 보이기 전에 평가한다 (var a = a;)
+            node->left = compileClosureExpr(compiler, var_stmt->initializer);
+        } else {
+            Function* function = (Function*)stmt;
+            name = function->name;
+            function->closure_code = compileClosureFunction(function);
+            node->left = createClosureNode(name);
+            node->left->eval = closureFunction;
+            node->left->function = function;
+        }
+        node->token = name;
+        node->name = name->name;
+        if (compiler->scope_depth == 0){
+            node->exec = closureDefineGlobal;
+            node->slot = globalSlot(name->name);
+        } else {
+            node->exec = closureDefineLocal;
+            node->slot = declareLocal(compiler, name->name);
+        }
+        return node;
+    }
+    if (stmt->accept == BlockStmtAccept){
+        int local_count = compiler->local_count;
+        compiler->scope_depth++;
+        ClosureNode* node = compileClosureBlock(compiler, ((Block*)stmt)->statements);
+        endScope(compiler, local_count);
+        return node;
+    }
+    if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        ClosureNode* node = createClosureNode(NULL);
+        node->exec = closureIf;
+        node->left = compileClosureExpr(compiler, if_stmt->condition);
+        node->right = compileClosureStmt(compiler, if_stmt->thenBranch);
+        if (if_stmt->elseBranch != NULL) node->other = compileClosureStmt(compiler, if_stmt->elseBranch);
+        return node;
+    }
+    if (stmt->accept == WhileStmtAccept){
+        While* while_stmt = (While*)stmt;
+        ClosureNode* node = createClosureNode(NULL);
+        node->exec = closureWhile;
+        node->left = compileClosureExpr(compiler, while_stmt->condition);
+        node->right = compileClosureStmt(compiler, while_stmt->body);
+        return node;
+    }
+    if (stmt->accept == ReturnStmtAccept){
+        Return* return_stmt = (Return*)stmt;
+        if (isTailCall(return_stmt->value)){
+            // 호출 노드를 그대로 문장으로 쓴다
+            ClosureNode* node = compileClosureExpr(compiler, return_stmt->value);
+            node->exec = closureTailCall;
+            return node;
+        }
+        ClosureNode* node = createClosureNode(return_stmt->keyword);
+        node->exec = closureReturn;
+        if (return_stmt->value != NULL){
+            node->left = compileClosureExpr(compiler, return_stmt->value);
+        } else {
+            node->left = createClosureNode(NULL);
+            node->left->eval = closureConstant;
+            node->left->constant = NIL_VAL;
+        }
+        return node;
+    }
+    compileError(compiler, "Unsupported statement.");
+    return NULL;
+}
+
+ClosureNode* compileClosureBlock(Compiler* compiler, Array* statements){
+    ClosureNode* node = createClosureNode(NULL);
+    node->exec = closureBlock;
+    node->child_count = statements->count;
+    node->children = (ClosureNode**)heapAllocate(sizeof(ClosureNode*) * (node->child_count + 1), HEAP_BYTECODE);
+    for (int i = 0; i < statements->count; i++){
+        node->children[i] = compileClosureStmt(compiler, elementStmt(getElement(statements, i)));
+    }
+    return node;
+}
+
+ClosureCode* compileClosureFunction(Function* function){
+    Compiler compiler = {NULL, NULL, 0, 0, 0, 1, 0, function->name->line};
+    // 본문은 인자와 같은 환경에서 실행되므로 같은 깊이에 선언한다
+    for (int i = 0; i < function->params->count; i++){
+        Element* element = getElement(function->params, i);
+        declareLocal(&compiler, element->data.token->name);
+    }
+    ClosureCode* code = (ClosureCode*)heapAllocate(sizeof(ClosureCode), HEAP_BYTECODE);
+    code->body = compileClosureBlock(&compiler, function->body);
+    code->slot_count = compiler.slot_count;
+    if (code->slot_count > SLOT_CHUNK_SIZE) compileError(&compiler, "Too many local variables in function.");
+    heapFree(compiler.locals);
+    return code;
+}
+
+ClosureCode* compileClosureScript(Array* statements){
+    Compiler compiler = {NULL, NULL, 0, 0, 0, 0, 0, 1};
+    ClosureCode* code = (ClosureCode*)heapAllocate(sizeof(ClosureCode), HEAP_BYTECODE);
+    code->body = compileClosureBlock(&compiler, statements);
+    code->slot_count = compiler.slot_count;
+    if (code->slot_count > SLOT_CHUNK_SIZE) compileError(&compiler, "Too many local variables in function.");
+    heapFree(compiler.locals);
+    return code;
+}
+
+Value* pushSlots(int count){
+    if (slot_stack == NULL || slot_stack->top + count > SLOT_CHUNK_SIZE){
+        SlotChunk* next = slot_stack ? slot_stack->next : NULL;
+        if (next == NULL){
+            next = (SlotChunk*)heapAllocate(sizeof(SlotChunk), HEAP_RUNTIME);
+            next->prev = slot_stack;
+            next->next = NULL;
+            if (slot_stack) slot_stack->next = next;
+        }
+        next->top = 0;
+        slot_stack = next;
+    }
+    Value* slots = slot_stack->values + slot_stack->top;
+    slot_stack->top += count;
+    return slots;
+}
+
+void popSlots(int count){
+    slot_stack->top -= count;
+    // 앞 덩어리에 자리가 모자라서 넘어왔던 경우 비었으면 되돌아간다
+    if (slot_stack->top == 0 && slot_stack->prev) slot_stack = slot_stack->prev;
+}
+
+void markSlotStack(){
+    for (SlotChunk* chunk = slot_stack; chunk; chunk = chunk->prev){
+        for (size_t i = 0; i < chunk->top; i++){
+            markValue(chunk->values[i]);
+        }
+    }
+}
+
+void closureSafePoint(){
+    if (gc.bytes_allocated > gc.next_gc || (heap.limit && heap.total > heap.collect_at)){
+        collectGarbage(closure_interpreter);
+    }
+}
+
+Value callClosureCode(ClosureCode* code, Value* args, int arg_count){
+    Value* slots = pushSlots(code->slot_count);
+    for (int i = 0; i < arg_count; i++) slots[i] = args[i];
+    for (int i = arg_count; i < code->slot_count; i++) slots[i] = NIL_VAL;
+    size_t temp_count = gc.temp_count;
+    Value result = NIL_VAL;
+    while (code->body->exec(code->body, slots)){
+        if (!closure_interpreter->tail_calling){
+            result = global_return_value;
+            break;
+        }
+        // 꼬리 호출은 지금 프레임을 내려놓고 같은 자리에 다음 함수의 프레임을 잡는다
+        closure_interpreter->tail_calling = 0;
+        gc.temp_count = temp_count;
+        pushTempRoot(closure_interpreter->tail_callee);
+        popSlots(code->slot_count);
+        code = ((LoxFunction*)AS_OBJ(closure_interpreter->tail_callee)->value)->declaration->closure_code;
+        slots = pushSlots(code->slot_count);
+        for (int i = 0; i < closure_interpreter->tail_arg_count; i++) slots[i] = closure_interpreter->tail_arguments[i];
+        for (int i = closure_interpreter->tail_arg_count; i < code->slot_count; i++) slots[i] = NIL_VAL;
+        closureSafePoint();
+    }
+    gc.temp_count = temp_count;
+    popSlots(code->slot_count);
+    return result;
+}
+
+void runClosures(Interpreter* interpreter, ClosureCode* script){
+    closure_interpreter = interpreter;
+    // 최상위의 return은 스크립트를 끝낸다
+    callClosureCode(script, NULL, 0);
+}
+
+// x86-64 레지스터 번호
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+#define JIT_RSI 6
+#define JIT_RDI 7
+// 0F 8x 형태 조건 점프의 두 번째 바이트, 0이면 무조건 점프
+#define JIT_JMP 0x00
+#define JIT_JB 0x82
+#define JIT_JAE 0x83
+#define JIT_JE 0x84
+#define JIT_JNE 0x85
+#define JIT_JBE 0x86
+#define JIT_JA 0x87
+#define JIT_JP 0x8A
+
+void jitEmit(JitAssembler* assembler, const uint8_t* bytes, int length){
+    if (assembler->count + length > assembler->capacity){
+        while (assembler->count + length > assembler->capacity){
+            assembler->capacity = assembler->capacity == 0 ? 256 : assembler->capacity * 2;
+        }
+        assembler->code = (uint8_t*)heapReallocate(assembler->code, assembler->capacity, HEAP_BYTECODE);
+    }
+    memcpy(assembler->code + assembler->count, bytes, length);
+    assembler->count += length;
+}
+
+void jitEmitByte(JitAssembler* assembler, uint8_t byte){
+    jitEmit(assembler, &byte, 1);
+}
+
+void jitEmitInt32(JitAssembler* assembler, int32_t value){
+    jitEmit(assembler, (uint8_t*)&value, 4);
+}
+
+void jitEmitImm64(JitAssembler* assembler, uint8_t reg, uint64_t value){
+    // movabs reg, imm64
+    uint8_t bytes[2] = {0x48, 0xB8 + reg};
+    jitEmit(assembler, bytes, 2);
+    jitEmit(assembler, (uint8_t*)&value, 8);
+}
+
+void jitEmitCall(JitAssembler* assembler, void* function){
+    // 인자는 rdi, rsi, rdx, rcx에 이미 있으므로 rax로 부른다
+    jitEmitImm64(assembler, JIT_RAX, (uint64_t)(uintptr_t)function);
+    uint8_t bytes[2] = {0xFF, 0xD0};
+    jitEmit(assembler, bytes, 2);
+}
+
+void jitEmitSlot(JitAssembler* assembler, uint8_t rex, uint8_t opcode, uint8_t reg, int base_is_temp, int index){
+    // 지역 슬롯은 [rbx + disp32], 임시 슬롯은 [r12 + disp32]
+    if (base_is_temp){
+        uint8_t bytes[4] = {rex | 0x01, opcode, 0x80 | (reg << 3) | 0x04, 0x24};
+        jitEmit(assembler, bytes, 4);
+    } else {
+        uint8_t bytes[3] = {rex, opcode, 0x80 | (reg << 3) | 0x03};
+        jitEmit(assembler, bytes, 3);
+    }
+    jitEmitInt32(assembler, index * (int)sizeof(Value));
+}
+
+int jitEmitJump(JitAssembler* assembler, uint8_t condition){
+    if (condition == JIT_JMP){
+        jitEmitByte(assembler, 0xE9);
+    } else {
+        uint8_t bytes[2] = {0x0F, condition};
+        jitEmit(assembler, bytes, 2);
+    }
+    jitEmitInt32(assembler, 0);
+    return assembler->count - 4;
+}
+
+void jitPatchJump(JitAssembler* assembler, int offset){
+    int32_t distance = assembler->count - (offset + 4);
+    memcpy(assembler->code + offset, &distance, 4);
+}
+
+void jitEmitJumpBack(JitAssembler* assembler, int target){
+    jitEmitByte(assembler, 0xE9);
+    jitEmitInt32(assembler, target - (assembler->count + 4));
+}
+
+void jitEmitError(JitAssembler* assembler, Token* token, char* message){
+    jitEmitImm64(assembler, JIT_RDI, (uint64_t)(uintptr_t)token);
+    jitEmitImm64(assembler, JIT_RSI, (uint64_t)(uintptr_t)message);
+    jitEmitCall(assembler, runtimeError);
+}
+
+void jitEmitJumpIfFalse(JitAssembler* assembler, int* patches, int* patch_count){
+    // rax가 nil이나 false면 점프한다
+    static const uint8_t cmp_rax_rdx[3] = {0x48, 0x39, 0xD0};
+    jitEmitImm64(assembler, JIT_RDX, NIL_VAL);
+    jitEmit(assembler, cmp_rax_rdx, 3);
+    patches[(*patch_count)++] = jitEmitJump(assembler, JIT_JE);
+    jitEmitImm64(assembler, JIT_RDX, FALSE_VAL);
+    jitEmit(assembler, cmp_rax_rdx, 3);
+    patches[(*patch_count)++] = jitEmitJump(assembler, JIT_JE);
+}
+
+void jitEmitNumberCheck(JitAssembler* assembler, int check_left, int check_right, Token* token, char* message){
+    // 왼쪽은 rax, 오른쪽은 rcx. QNAN 비트가 모두 켜져 있으면 숫자가 아니다
+    static const uint8_t test_rax[9] = {0x48, 0x89, 0xC6, 0x48, 0x21, 0xD6, 0x48, 0x39, 0xD6};
+    static const uint8_t test_rcx[9] = {0x48, 0x89, 0xCE, 0x48, 0x21, 0xD6, 0x48, 0x39, 0xD6};
+    if (!check_left && !check_right) return;
+    int patches[2];
+    int patch_count = 0;
+    jitEmitImm64(assembler, JIT_RDX, QNAN);
+    if (check_left){
+        jitEmit(assembler, test_rax, 9);
+        patches[patch_count++] = jitEmitJump(assembler, JIT_JE);
+    }
+    if (check_right){
+        jitEmit(assembler, test_rcx, 9);
+        patches[patch_count++] = jitEmitJump(assembler, JIT_JE);
+    }
+    int ok_jump = jitEmitJump(assembler, JIT_JMP);
+    for (int i = 0; i < patch_count; i++) jitPatchJump(assembler, patches[i]);
+    jitEmitError(assembler, token, message);
+    jitPatchJump(assembler, ok_jump);
+}
+
+int jitAllocateTemp(JitAssembler* assembler){
+    int temp = assembler->temp_count++;
+    if (assembler->temp_count > assembler->max_temps) assembler->max_temps = assembler->temp_count;
+    return temp;
+}
+
+Expr* jitUnwrap(Expr* expr){
+    while (expr->accept == ExprGroupingAccept) expr = ((ExprGrouping*)expr)->expression;
+    return expr;
+}
+
+int jitIsLeaf(JitAssembler* assembler, Expr* expr){
+    // 부수 효과도 할당도 없이 레지스터 하나로 읽을 수 있는 식
+    expr = jitUnwrap(expr);
+    if (expr->accept == ExprLiteralAccept) return 1;
+    return expr->accept == ExprVariableAccept && resolveLocal(&assembler->compiler, ((Variable*)expr)->name->name) >= 0;
+}
+
+int jitIsNumberLiteral(Expr* expr){
+    expr = jitUnwrap(expr);
+    return expr->accept == ExprLiteralAccept && IS_NUMBER(((ExprLiteral*)expr)->constant);
+}
+
+void jitCompileLeaf(JitAssembler* assembler, Expr* expr, uint8_t reg){
+    expr = jitUnwrap(expr);
+    if (expr->accept == ExprLiteralAccept){
+        jitEmitImm64(assembler, reg, ((ExprLiteral*)expr)->constant);
+    } else {
+        int slot = resolveLocal(&assembler->compiler, ((Variable*)expr)->name->name);
+        jitEmitSlot(assembler, 0x48, 0x8B, reg, 0, slot);
+    }
+}
+
+void jitCompileOperands(JitAssembler* assembler, ExprBinary* binary){
+    // 왼쪽을 rax, 오른쪽을 rcx에 둔다. 평가 순서는 인터프리터와 같다
+    static const uint8_t mov_rcx_rax[3] = {0x48, 0x89, 0xC1};
+    if (jitIsLeaf(assembler, binary->right)){
+        jitCompileExpr(assembler, binary->left);
+        jitCompileLeaf(assembler, binary->right, JIT_RCX);
+        return;
+    }
+    if (jitUnwrap(binary->left)->accept == ExprLiteralAccept){
+        jitCompileExpr(assembler, binary->right);
+        jitEmit(assembler, mov_rcx_rax, 3);
+        jitCompileLeaf(assembler, binary->left, JIT_RAX);
+        return;
+    }
+    // 오른쪽을 평가하는 동안 수집될 수 있으므로 왼쪽은 프레임의 임시 슬롯에 둔다
+    jitCompileExpr(assembler, binary->left);
+    int temp = jitAllocateTemp(assembler);
+    jitEmitSlot(assembler, 0x48, 0x89, JIT_RAX, 1, temp);
+    jitCompileExpr(assembler, binary->right);
+    jitEmit(assembler, mov_rcx_rax, 3);
+    jitEmitSlot(assembler, 0x48, 0x8B, JIT_RAX, 1, temp);
+    assembler->temp_count--;
+}
+
+void jitCompileExpr(JitAssembler* assembler, Expr* expr){
+    static const uint8_t load_operands[10] = {0x66, 0x48, 0x0F, 0x6E, 0xC0, 0x66, 0x48, 0x0F, 0x6E, 0xC9};
+    static const uint8_t store_result[5] = {0x66, 0x48, 0x0F, 0x7E, 0xC0};
+    if (assembler->rejected) return;
+    expr = jitUnwrap(expr);
+    if (jitIsLeaf(assembler, expr)){
+        jitCompileLeaf(assembler, expr, JIT_RAX);
+        return;
+    }
+    if (expr->accept == ExprVariableAccept){
+        // 전역은 테이블에서 바로 읽고, 정의되지 않았을 때만 에러를 보고하러 나간다
+        static const uint8_t load_values[3] = {0x48, 0x8B, 0x00};   // mov rax, [rax]
+        static const uint8_t cmp_rax_rcx[3] = {0x48, 0x39, 0xC8};
+        Token* name = ((Variable*)expr)->name;
+        int32_t displacement = (int32_t)(globalSlot(name->name) * sizeof(Value));
+        uint8_t load_slot[7] = {0x48, 0x8B, 0x80};                   // mov rax, [rax + disp32]
+        memcpy(load_slot + 3, &displacement, 4);
+        jitEmitImm64(assembler, JIT_RAX, (uint64_t)(uintptr_t)&global_table.values);
+        jitEmit(assembler, load_values, 3);
+        jitEmit(assembler, load_slot, 7);
+        jitEmitImm64(assembler, JIT_RCX, UNDEFINED_VAL);
+        jitEmit(assembler, cmp_rax_rcx, 3);
+        int defined = jitEmitJump(assembler, JIT_JNE);
+        jitEmitImm64(assembler, JIT_RDI, (uint64_t)(uintptr_t)name);
+        jitEmitCall(assembler, jitGetGlobal);
+        jitPatchJump(assembler, defined);
+        return;
+    }
+    if (expr->accept == ExprAssignAccept){
+        Assign* assign = (Assign*)expr;
+        jitCompileExpr(assembler, assign->value);
+        int slot = resolveLocal(&assembler->compiler, assign->name->name);
+        if (slot >= 0){
+            jitEmitSlot(assembler, 0x48, 0x89, JIT_RAX, 0, slot);
+        } else {
+            static const uint8_t mov_rsi_rax[3] = {0x48, 0x89, 0xC6};
+            jitEmit(assembler, mov_rsi_rax, 3);
+            jitEmitImm64(assembler, JIT_RDI, (uint64_t)globalSlot(assign->name->name));
+            jitEmitImm64(assembler, JIT_RDX, (uint64_t)(uintptr_t)assign->name);
+            jitEmitCall(assembler, jitSetGlobal);
+        }
+        return;
+    }
+    if (expr->accept == ExprLogicalAccept){
+        Logical* logical = (Logical*)expr;
+        int patches[3];
+        int patch_count = 0;
+        jitCompileExpr(assembler, logical->left);
+        if (logical->operator->type == OR){
+            jitEmitJumpIfFalse(assembler, patches, &patch_count);
+            int end_jump = jitEmitJump(assembler, JIT_JMP);
+            for (int i = 0; i < patch_count; i++) jitPatchJump(assembler, patches[i]);
+            jitCompileExpr(assembler, logical->right);
+            jitPatchJump(assembler, end_jump);
+        } else {
+            jitEmitJumpIfFalse(assembler, patches, &patch_count);
+            jitCompileExpr(assembler, logical->right);
+            for (int i = 0; i < patch_count; i++) jitPatchJump(assembler, patches[i]);
+        }
+        return;
+    }
+    if (isUnaryExpr(expr)){
+        ExprUnary* unary = (ExprUnary*)expr;
+        jitCompileExpr(assembler, unary->right);
+        if (unary->operator->type == MINUS){
+            static const uint8_t xor_rax_rdx[3] = {0x48, 0x31, 0xD0};
+            jitEmitNumberCheck(assembler, 1, 0, unary->operator, "Operand must be a number.");
+            jitEmitImm64(assembler, JIT_RDX, SIGN_BIT);
+            jitEmit(assembler, xor_rax_rdx, 3);
+        } else {
+            static const uint8_t mov_rcx_rax[3] = {0x48, 0x89, 0xC1};
+            static const uint8_t cmp_rcx_rdx[3] = {0x48, 0x39, 0xD1};
+            jitEmit(assembler, mov_rcx_rax, 3);
+            jitEmitImm64(assembler, JIT_RAX, TRUE_VAL);
+            jitEmitImm64(assembler, JIT_RDX, NIL_VAL);
+            jitEmit(assembler, cmp_rcx_rdx, 3);
+            int nil_jump = jitEmitJump(assembler, JIT_JE);
+            jitEmitImm64(assembler, JIT_RDX, FALSE_VAL);
+            jitEmit(assembler, cmp_rcx_rdx, 3);
+            int false_jump = jitEmitJump(assembler, JIT_JE);
+            jitEmitImm64(assembler, JIT_RAX, FALSE_VAL);
+            jitPatchJump(assembler, nil_jump);
+            jitPatchJump(assembler, false_jump);
+        }
+        return;
+    }
+    if (isBinaryExpr(expr)){
+        ExprBinary* binary = (ExprBinary*)expr;
+        Token* operator = binary->operator;
+        int check_left = !jitIsNumberLiteral(binary->left);
+        int check_right = !jitIsNumberLiteral(binary->right);
+        jitCompileOperands(assembler, binary);
+        switch (operator->type){
+            case PLUS: {
+                static const uint8_t test_rax[9] = {0x48, 0x89, 0xC6, 0x48, 0x21, 0xD6, 0x48, 0x39, 0xD6};
+                static const uint8_t test_rcx[9] = {0x48, 0x89, 0xCE, 0x48, 0x21, 0xD6, 0x48, 0x39, 0xD6};
+                static const uint8_t addsd[4] = {0xF2, 0x0F, 0x58, 0xC1};
+                static const uint8_t move_arguments[6] = {0x48, 0x89, 0xC7, 0x48, 0x89, 0xCE};
+                int slow[2];
+                int slow_count = 0;
+                if (check_left || check_right) jitEmitImm64(assembler, JIT_RDX, QNAN);
+                if (check_left){
+                    jitEmit(assembler, test_rax, 9);
+                    slow[slow_count++] = jitEmitJump(assembler, JIT_JE);
+                }
+                if (check_right){
+                    jitEmit(assembler, test_rcx, 9);
+                    slow[slow_count++] = jitEmitJump(assembler, JIT_JE);
+                }
+                jitEmit(assembler, load_operands, 10);
+                jitEmit(assembler, addsd, 4);
+                jitEmit(assembler, store_result, 5);
+                if (slow_count == 0) return;
+                // 숫자가 아니면 문자열 연결과 에러 처리를 인터프리터와 같은 함수에 맡긴다
+                int done_jump = jitEmitJump(assembler, JIT_JMP);
+                for (int i = 0; i < slow_count; i++) jitPatchJump(assembler, slow[i]);
+                jitEmit(assembler, move_arguments, 6);
+                jitEmitImm64(assembler, JIT_RDX, (uint64_t)(uintptr_t)operator);
+                jitEmitCall(assembler, jitAdd);
+                jitPatchJump(assembler, done_jump);
+                return;
+            }
+            case MINUS:
+            case STAR:
+            case SLASH: {
+                uint8_t opcode = operator->type == MINUS ? 0x5C : operator->type == STAR ? 0x59 : 0x5E;
+                uint8_t arithmetic[4] = {0xF2, 0x0F, opcode, 0xC1};
+                jitEmitNumberCheck(assembler, check_left, check_right, operator, "Operands must be numbers.");
+                jitEmit(assembler, load_operands, 10);
+                jitEmit(assembler, arithmetic, 4);
+                jitEmit(assembler, store_result, 5);
+                return;
+            }
+            case GREATER:
+            case GREATER_EQUAL:
+            case LESS:
+            case LESS_EQUAL: {
+                // a < b는 b > a로 바꿔서 NaN이면 거짓이 되는 seta/setae만 쓴다
+                int swap = operator->type == LESS || operator->type == LESS_EQUAL;
+                int or_equal = operator->type == GREATER_EQUAL || operator->type == LESS_EQUAL;
+                uint8_t compare[4] = {0x66, 0x0F, 0x2E, swap ? 0xC8 : 0xC1};
+                uint8_t set_flag[6] = {0x0F, or_equal ? 0x93 : 0x97, 0xC1, 0x0F, 0xB6, 0xC9};
+                static const uint8_t add_rax_rcx[3] = {0x48, 0x01, 0xC8};
+                jitEmitNumberCheck(assembler, check_left, check_right, operator, "Operands must be numbers.");
+                jitEmit(assembler, load_operands, 10);
+                jitEmit(assembler, compare, 4);
+                jitEmit(assembler, set_flag, 6);
+                jitEmitImm64(assembler, JIT_RAX, FALSE_VAL);
+                jitEmit(assembler, add_rax_rcx, 3);
+                return;
+            }
+            default: {
+                static const uint8_t test_rax[9] = {0x48, 0x89, 0xC6, 0x48, 0x21, 0xD6, 0x48, 0x39, 0xD6};
+                static const uint8_t test_rcx[9] = {0x48, 0x89, 0xCE, 0x48, 0x21, 0xD6, 0x48, 0x39, 0xD6};
+                static const uint8_t compare[4] = {0x66, 0x0F, 0x2E, 0xC1};
+                static const uint8_t or_rax_1[4] = {0x48, 0x83, 0xC8, 0x01};
+                static const uint8_t xor_rax_1[4] = {0x48, 0x83, 0xF0, 0x01};
+                static const uint8_t move_arguments[6] = {0x48, 0x89, 0xC7, 0x48, 0x89, 0xCE};
+                int slow[2];
+                int slow_count = 0;
+                jitEmitImm64(assembler, JIT_RDX, QNAN);
+                jitEmit(assembler, test_rax, 9);
+                slow[slow_count++] = jitEmitJump(assembler, JIT_JE);
+                jitEmit(assembler, test_rcx, 9);
+                slow[slow_count++] = jitEmitJump(assembler, JIT_JE);
+                jitEmit(assembler, load_operands, 10);
+                jitEmit(assembler, compare, 4);
+                jitEmitImm64(assembler, JIT_RAX, FALSE_VAL);
+                // ZF=1이고 PF=0일 때만 같다 (NaN은 자기 자신과도 다르다)
+                int not_equal = jitEmitJump(assembler, JIT_JNE);
+                int unordered = jitEmitJump(assembler, JIT_JP);
+                jitEmit(assembler, or_rax_1, 4);
+                jitPatchJump(assembler, not_equal);
+                jitPatchJump(assembler, unordered);
+                int done_jump = jitEmitJump(assembler, JIT_JMP);
+                for (int i = 0; i < slow_count; i++) jitPatchJump(assembler, slow[i]);
+                jitEmit(assembler, move_arguments, 6);
+                jitEmitCall(assembler, jitEqual);
+                jitPatchJump(assembler, done_jump);
+                // true와 false는 마지막 비트만 다르다
+                if (operator->type == BANG_EQUAL) jitEmit(assembler, xor_rax_1, 4);
+                return;
+            }
+        }
+    }
+    if (expr->accept == ExprCallAccept){
+        Call* call = (Call*)expr;
+        int arg_count = call->arguments->count;
+        int base = assembler->temp_count;
+        for (int i = 0; i <= arg_count; i++) jitAllocateTemp(assembler);
+        jitCompileExpr(assembler, call->callee);
+        jitEmitSlot(assembler, 0x48, 0x89, JIT_RAX, 1, base);
+        for (int i = 0; i < arg_count; i++){
+            Element* element = getElement(call->arguments, i);
+            jitCompileExpr(assembler, element->data.expr_stmt->expression);
+            jitEmitSlot(assembler, 0x48, 0x89, JIT_RAX, 1, base + 1 + i);
+        }
+        jitEmitSlot(assembler, 0x48, 0x8B, JIT_RDI, 1, base);
+        jitEmitSlot(assembler, 0x48, 0x8D, JIT_RSI, 1, base + 1);
+        jitEmitByte(assembler, 0xBA); // mov edx, imm32
+        jitEmitInt32(assembler, arg_count);
+        jitEmitImm64(assembler, JIT_RCX, (uint64_t)(uintptr_t)call->paren);
+        jitEmitCall(assembler, jitCall);
+        assembler->temp_count = base;
+        return;
+    }
+    assembler->rejected = 1;
+}
+
+void jitCompileCondition(JitAssembler* assembler, Expr* expr, int* patches, int* patch_count){
+    // 비교 결과로 바로 분기하면 불리언 값을 만들지 않아도 된다
+    expr = jitUnwrap(expr);
+    if (isBinaryExpr(expr)){
+        ExprBinary* binary = (ExprBinary*)expr;
+        TokenType type = binary->operator->type;
+        if (type == GREATER || type == GREATER_EQUAL || type == LESS || type == LESS_EQUAL){
+            static const uint8_t load_operands[10] = {0x66, 0x48, 0x0F, 0x6E, 0xC0, 0x66, 0x48, 0x0F, 0x6E, 0xC9};
+            int swap = type == LESS || type == LESS_EQUAL;
+            int or_equal = type == GREATER_EQUAL || type == LESS_EQUAL;
+            uint8_t compare[4] = {0x66, 0x0F, 0x2E, swap ? 0xC8 : 0xC1};
+            int check_left = !jitIsNumberLiteral(binary->left);
+            int check_right = !jitIsNumberLiteral(binary->right);
+            jitCompileOperands(assembler, binary);
+            jitEmitNumberCheck(assembler, check_left, check_right, binary->operator, "Operands must be numbers.");
+            jitEmit(assembler, load_operands, 10);
+            jitEmit(assembler, compare, 4);
+            patches[(*patch_count)++] = jitEmitJump(assembler, or_equal ? JIT_JB : JIT_JBE);
+            return;
+        }
+    }
+    jitCompileExpr(assembler, expr);
+    jitEmitJumpIfFalse(assembler, patches, patch_count);
+}
+
+void jitCompileTailCall(JitAssembler* assembler, Call* call){
+    static const uint8_t test_eax[2] = {0x85, 0xC0};
+    int arg_count = call->arguments->count;
+    int base = assembler->temp_count;
+    for (int i = 0; i <= arg_count; i++) jitAllocateTemp(assembler);
+    jitCompileExpr(assembler, call->callee);
+    jitEmitSlot(assembler, 0x48, 0x89, JIT_RAX, 1, base);
+    for (int i = 0; i < arg_count; i++){
+        Element* element = getElement(call->arguments, i);
+        jitCompileExpr(assembler, element->data.expr_stmt->expression);
+        jitEmitSlot(assembler, 0x48, 0x89, JIT_RAX, 1, base + 1 + i);
+    }
+    if (arg_count == assembler->function->params->count){
+        // 자기 자신이면 인자 슬롯만 바꾸고 본문 처음으로 뛰어서 반복문처럼 돈다
+        jitEmitSlot(assembler, 0x48, 0x8B, JIT_RDI, 1, base);
+        jitEmitImm64(assembler, JIT_RSI, (uint64_t)(uintptr_t)assembler->function);
+        jitEmitCall(assembler, jitIsSelfCall);
+        jitEmit(assembler, test_eax, 2);
+        int not_self = jitEmitJump(assembler, JIT_JE);
+        for (int i = 0; i < arg_count; i++){
+            jitEmitSlot(assembler, 0x48, 0x8B, JIT_RAX, 1, base + 1 + i);
+            jitEmitSlot(assembler, 0x48, 0x89, JIT_RAX, 0, i);
+        }
+        jitEmitJumpBack(assembler, assembler->body_start);
+        jitPatchJump(assembler, not_self);
+    }
+    // 다른 함수는 인터프리터에 넘기고 돌아가서 부른 쪽이 이어서 실행하게 한다
+    jitEmitSlot(assembler, 0x48, 0x8B, JIT_RDI, 1, base);
+    jitEmitSlot(assembler, 0x48, 0x8D, JIT_RSI, 1, base + 1);
+    jitEmitByte(assembler, 0xBA); // mov edx, imm32
+    jitEmitInt32(assembler, arg_count);
+    jitEmitImm64(assembler, JIT_RCX, (uint64_t)(uintptr_t)call->paren);
+    jitEmitCall(assembler, jitTailCall);
+    assembler->temp_count = base;
+}
+
+void jitCompileStmt(JitAssembler* assembler, Stmt* stmt){
+    static const uint8_t epilogue[5] = {0x41, 0x5C, 0x5B, 0x5D, 0xC3};
+    if (assembler->rejected) return;
+    if (stmt->accept == ExpressionStmtAccept){
+        jitCompileExpr(assembler, ((Expression*)stmt)->expression);
+        return;
+    }
+    if (stmt->accept == VarStmtAccept){
+        Var* var_stmt = (Var*)stmt;
+        jitCompileExpr(assembler, var_stmt->initializer);
+        int slot = declareLocal(&assembler->compiler, var_stmt->name->name);
+        jitEmitSlot(assembler, 0x48, 0x89, JIT_RAX, 0, slot);
+        return;
+    }
+    if (stmt->accept == BlockStmtAccept){
+        Array* statements = ((Block*)stmt)->statements;
+        int local_count = assembler->compiler.local_count;
+        assembler->compiler.scope_depth++;
+        for (int i = 0; i < statements->count; i++){
+            jitCompileStmt(assembler, elementStmt(getElement(statements, i)));
+        }
+        endScope(&assembler->compiler, local_count);
+        return;
+    }
+    if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        int patches[2];
+        int patch_count = 0;
+        jitCompileCondition(assembler, if_stmt->condition, patches, &patch_count);
+        jitCompileStmt(assembler, if_stmt->thenBranch);
+        if (if_stmt->elseBranch != NULL){
+            int end_jump = jitEmitJump(assembler, JIT_JMP);
+            for (int i = 0; i < patch_count; i++) jitPatchJump(assembler, patches[i]);
+            jitCompileStmt(assembler, if_stmt->elseBranch);
+            jitPatchJump(assembler, end_jump);
+        } else {
+            for (int i = 0; i < patch_count; i++) jitPatchJump(assembler, patches[i]);
+        }
+        return;
+    }
+    if (stmt->accept == WhileStmtAccept){
+        While* while_stmt = (While*)stmt;
+        int patches[2];
+        int patch_count = 0;
+        int loop_start = assembler->count;
+        jitCompileCondition(assembler, while_stmt->condition, patches, &patch_count);
+        jitCompileStmt(assembler, while_stmt->body);
+        jitEmitJumpBack(assembler, loop_start);
+        for (int i = 0; i < patch_count; i++) jitPatchJump(assembler, patches[i]);
+        return;
+    }
+    if (stmt->accept == ReturnStmtAccept){
+        Return* return_stmt = (Return*)stmt;
+        if (isTailCall(return_stmt->value)){
+            jitCompileTailCall(assembler, (Call*)return_stmt->value);
+        } else if (return_stmt->value != NULL){
+            jitCompileExpr(assembler, return_stmt->value);
+        } else {
+            jitEmitImm64(assembler, JIT_RAX, NIL_VAL);
+        }
+        jitEmit(assembler, epilogue, 5);
+        return;
+    }
+    // print, 함수 선언은 인터프리터에 남긴다
+    assembler->rejected = 1;
+}
+
+JitCode* jitCompile(Function* function){
+#ifdef JIT_SUPPORTED
+    // push rbp; mov rbp, rsp; push rbx; push r12; mov rbx, rdi; lea r12, [rbx + disp32]
+    static const uint8_t prologue[13] = {0x55, 0x48, 0x89, 0xE5, 0x53, 0x41, 0x54, 0x48, 0x89, 0xFB, 0x4C, 0x8D, 0xA3};
+    static const uint8_t epilogue[5] = {0x41, 0x5C, 0x5B, 0x5D, 0xC3};
+    JitAssembler assembler = {{NULL, NULL, 0, 0, 0, 1, 0, function->name->line}, NULL, 0, 0, 0, 0, 0, function, 0};
+    for (int i = 0; i < function->params->count; i++){
+        Element* element = getElement(function->params, i);
+        declareLocal(&assembler.compiler, element->data.token->name);
+    }
+    jitEmit(&assembler, prologue, 13);
+    int temp_base = assembler.count;
+    jitEmitInt32(&assembler, 0);
+    assembler.body_start = assembler.count;
+    for (int i = 0; i < function->body->count && !assembler.rejected; i++){
+        jitCompileStmt(&assembler, elementStmt(getElement(function->body, i)));
+    }
+    jitEmitImm64(&assembler, JIT_RAX, NIL_VAL);
+    jitEmit(&assembler, epilogue, 5);
+
+    JitCode* code = NULL;
+    int frame_size = assembler.compiler.slot_count + assembler.max_temps;
+    if (!assembler.rejected && frame_size <= SLOT_CHUNK_SIZE){
+        int32_t temp_offset = assembler.compiler.slot_count * (int)sizeof(Value);
+        memcpy(assembler.code + temp_base, &temp_offset, 4);
+        // 쓰기와 실행을 동시에 허용하지 않는다
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size_t mapped = (assembler.count + page_size - 1) / page_size * page_size;
+        void* memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory != MAP_FAILED){
+            memcpy(memory, assembler.code, assembler.count);
+            if (mprotect(memory, mapped, PROT_READ | PROT_EXEC) == 0){
+                code = (JitCode*)heapAllocate(sizeof(JitCode), HEAP_BYTECODE);
+                code->entry = (Value (*)(Value*))memory;
+                code->frame_size = frame_size;
+                code->size = assembler.count;
+                jit.compiled++;
+                jit.code_bytes += assembler.count;
+                jit.mapped_bytes += mapped;
+            } else {
+                munmap(memory, mapped);
+            }
+        }
+    }
+    if (code == NULL){
+        function->jit_rejected = 1;
+        jit.rejected++;
+    }
+    heapFree(assembler.code);
+    heapFree(assembler.compiler.locals);
+    return code;
+#else
+    function->jit_rejected = 1;
+    return NULL;
+#endif
+}
+
+void jitSafePoint(Value left, Value right){
+    // 기계어 코드의 값은 모두 프레임에 있고, 레지스터에 있던 피연산자만 잠시 루트로 잡는다
+    if (gc.bytes_allocated > gc.next_gc || (heap.limit && heap.total > heap.collect_at)){
+        size_t temp_count = gc.temp_count;
+        pushTempRoot(left);
+        pushTempRoot(right);
+        collectGarbage(jit_interpreter);
+        gc.temp_count = temp_count;
+    }
+}
+
+Value jitAdd(Value left, Value right, Token* token){
+    jitSafePoint(left, right);
+    Value result;
+    if (!plusOperation(left, right, &result)) runtimeError(token, "Operands must be two numbers or two strings.");
+    // 프레임은 문장 경계를 넘어 살아 있으므로 nursery 객체를 두지 않는다
+    return promoteValue(result);
+}
+
+Value jitEqual(Value left, Value right){
+    return BOOL_VAL(isEqual(left, right));
+}
+
+Value jitGetGlobal(Token* name){
+    return getGlobal(globalSlot(name->name), name);
+}
+
+Value jitSetGlobal(int slot, Value value, Token* name){
+    setGlobal(slot, name, value);
+    return value;
+}
+
+Value jitCall(Value callee, Value* args, int arg_count, Token* paren){
+    if (!IS_FUNCTION(callee)) runtimeError(paren, "Can only call functions and classes.");
+    LoxCallable* lox_callable = (LoxCallable*)AS_OBJ(callee)->value;
+    int expected = lox_callable->arity(lox_callable);
+    if (arg_count != expected){
+        char message[64];
+        snprintf(message, sizeof(message), "Expected %d arguments but got %zu.", expected, (size_t)arg_count);
+        runtimeError(paren, message);
+    }
+    Function* declaration = ((LoxFunction*)lox_callable)->declaration;
+    if (jit_interpreter->call_depth >= max_call_depth || stackExhausted()) runtimeError(paren, "Stack overflow.");
+    jit_interpreter->call_depth++;
+    Value result;
+    if (declaration && declaration->jit_code){
+        Value* slots = pushJitFrame(declaration->jit_code, arg_count);
+        for (int i = 0; i < arg_count; i++) slots[i] = args[i];
+        result = runJitCode(declaration->jit_code, slots);
+        if (jit_interpreter->tail_calling){
+            // 기계어 코드가 다른 함수를 꼬리 호출했으면 functionCall이 이어서 실행한다
+            jit_interpreter->tail_calling = 0;
+            Value next = jit_interpreter->tail_callee;
+            int next_count = jit_interpreter->tail_arg_count;
+            size_t temp_count = gc.temp_count;
+            pushTempRoot(next);
+            Value* frame = pushSlots(next_count);
+            for (int i = 0; i < next_count; i++) frame[i] = jit_interpreter->tail_arguments[i];
+            result = functionCall(AS_OBJ(next)->value, jit_interpreter, frame, next_count);
+            popSlots(next_count);
+            gc.temp_count = temp_count;
+        }
+    } else {
+        result = lox_callable->call(lox_callable, jit_interpreter, args, arg_count);
+    }
+    jit_interpreter->call_depth--;
+    return promoteValue(result);
+}
+
+int jitIsSelfCall(Value callee, Function* function){
+    return IS_FUNCTION(callee) && ((LoxFunction*)AS_OBJ(callee)->value)->declaration == function;
+}
+
+Value jitTailCall(Value callee, Value* args, int arg_count, Token* paren){
+    LoxCallable* lox_callable = checkCallable(callee, paren, arg_count);
+    if (((LoxFunction*)lox_callable)->declaration == NULL){
+        return promoteValue(lox_callable->call(lox_callable, jit_interpreter, args, arg_count));
+    }
+    for (int i = 0; i < arg_count; i++) jit_interpreter->tail_arguments[i] = args[i];
+    jit_interpreter->tail_callee = callee;
+    jit_interpreter->tail_arg_count = arg_count;
+    jit_interpreter->tail_calling = 1;
+    return NIL_VAL;
+}
+
+Value* pushJitFrame(JitCode* code, int arg_count){
+    // 슬롯 스택의 묵은 값이 수집 중에 읽히지 않도록 인자 뒤를 모두 nil로 채운다
+    Value* slots = pushSlots(code->frame_size);
+    for (int i = arg_count; i < code->frame_size; i++) slots[i] = NIL_VAL;
+    return slots;
+}
+
+Value runJitCode(JitCode* code, Value* slots){
+    jit.entries++;
+    Value result = code->entry(slots);
+    popSlots(code->frame_size);
+    return result;
+}
+
+void printJitStats(){
+    if (!jit.enabled){
+        fprintf(stderr, "[jit] disabled\n");
+        return;
+    }
+    fprintf(stderr, "[jit] %ld functions compiled, %ld rejected, %ld calls entered compiled code (threshold %d)\n",
+            jit.compiled, jit.rejected, jit.entries, jit.threshold);
+    fprintf(stderr, "[jit] %zu bytes of code in %zu bytes of executable pages\n", jit.code_bytes, jit.mapped_bytes);
+}
+
+// 변수 노드가 어디에 있는 이름인지 정적으로 정한다. 함수는 전역 환경만 감싸므로 본문이나 바깥 블록에서
+// 선언되지 않은 이름은 전역이고 전역 테이블 슬롯을 바로 가리킨다. 인자는 param_count보다 앞의 슬롯이고
+// 환경 대신 호출 프레임에서 읽는다
+void resolveVariablesExpr(Compiler* compiler, int param_count, Expr* expr){
+    if (expr == NULL) return;
+    if (expr->accept == ExprGroupingAccept){
+        resolveVariablesExpr(compiler, param_count, ((ExprGrouping*)expr)->expression);
+        return;
+    }
+    if (expr->accept == ExprVariableAccept){
+        Variable* variable = (Variable*)expr;
+        int slot = resolveLocal(compiler, variable->name->name);
+        if (slot >= 0 && slot < param_count) variable->slot = slot;
+        if (slot < 0) variable->global_slot = globalSlot(variable->name->name);
+        return;
+    }
+    if (expr->accept == ExprAssignAccept){
+        Assign* assign = (Assign*)expr;
+        resolveVariablesExpr(compiler, param_count, assign->value);
+        int slot = resolveLocal(compiler, assign->name->name);
+        if (slot >= 0 && slot < param_count) assign->slot = slot;
+        if (slot < 0) assign->global_slot = globalSlot(assign->name->name);
+        return;
+    }
+    if (expr->accept == ExprLogicalAccept){
+        resolveVariablesExpr(compiler, param_count, ((Logical*)expr)->left);
+        resolveVariablesExpr(compiler, param_count, ((Logical*)expr)->right);
+        return;
+    }
+    if (isUnaryExpr(expr)){
+        resolveVariablesExpr(compiler, param_count, ((ExprUnary*)expr)->right);
+        return;
+    }
+    if (isBinaryExpr(expr)){
+        resolveVariablesExpr(compiler, param_count, ((ExprBinary*)expr)->left);
+        resolveVariablesExpr(compiler, param_count, ((ExprBinary*)expr)->right);
+        return;
+    }
+    if (expr->accept == ExprCallAccept){
+        Call* call = (Call*)expr;
+        resolveVariablesExpr(compiler, param_count, call->callee);
+        if (call->callee->accept == ExprVariableAccept){
+            call->global_callee = resolveLocal(compiler, ((Variable*)call->callee)->name->name) < 0;
+        }
+        for (int i = 0; i < call->arguments->count; i++){
+            Element* element = getElement(call->arguments, i);
+            resolveVariablesExpr(compiler, param_count, element->data.expr_stmt->expression);
+        }
+    }
+}
+
+void resolveVariablesStmt(Compiler* compiler, int param_count, Stmt* stmt){
+    if (stmt == NULL) return;
+    if (stmt->accept == PrintStmtAccept){
+        resolveVariablesExpr(compiler, param_count, ((Print*)stmt)->expression);
+        return;
+    }
+    if (stmt->accept == ExpressionStmtAccept){
+        resolveVariablesExpr(compiler, param_count, ((Expression*)stmt)->expression);
+        return;
+    }
+    if (stmt->accept == VarStmtAccept){
+        Var* var_stmt = (Var*)stmt;
+        // 초기값은 새 이름이 선언되기 전에 평가된다. 최상위의 선언은 전역이므로 지역으로 세지 않는다
+        resolveVariablesExpr(compiler, param_count, var_stmt->initializer);
+        if (compiler->scope_depth > 0) declareLocal(compiler, var_stmt->name->name);
+        return;
+    }
+    if (stmt->accept == BlockStmtAccept){
+        Block* block_stmt = (Block*)stmt;
+        int local_count = compiler->local_count;
+        compiler->scope_depth++;
+        for (int i = 0; i < block_stmt->statements->count; i++){
+            resolveVariablesStmt(compiler, param_count, elementStmt(getElement(block_stmt->statements, i)));
+        }
+        endScope(compiler, local_count);
+        return;
+    }
+    if (stmt->accept == IfStmtAccept){
+        If* if_stmt = (If*)stmt;
+        resolveVariablesExpr(compiler, param_count, if_stmt->condition);
+        resolveVariablesStmt(compiler, param_count, if_stmt->thenBranch);
+        resolveVariablesStmt(compiler, param_count, if_stmt->elseBranch);
+        return;
+    }
+    if (stmt->accept == WhileStmtAccept){
+        While* while_stmt = (While*)stmt;
+        resolveVariablesExpr(compiler, param_count, while_stmt->condition);
+        resolveVariablesStmt(compiler, param_count, while_stmt->body);
+        return;
+    }
+    if (stmt->accept == ReturnStmtAccept){
+        resolveVariablesExpr(compiler, param_count, ((Return*)stmt)->value);
+        return;
+    }
+    if (stmt->accept == FunctionStmtAccept){
+        Function* function_stmt = (Function*)stmt;
+        if (compiler->scope_depth > 0) declareLocal(compiler, function_stmt->name->name);
+        resolveVariablesFunction(function_stmt);
+    }
+}
+
+void resolveVariablesFunction(Function* function){
+    function->body_declares = 0;
+    function->param_slots = 1;
+    for (int i = 0; i < function->body->count; i++){
+        Stmt* stmt = elementStmt(getElement(function->body, i));
+        Token* name = NULL;
+        if (stmt->accept == VarStmtAccept) name = ((Var*)stmt)->name;
+        if (stmt->accept == FunctionStmtAccept) name = ((Function*)stmt)->name;
+        if (name == NULL) continue;
+        function->body_declares = 1;
+        // 본문 최상위의 선언은 인자와 같은 환경에 들어가 인자를 덮어쓰므로 이름으로 찾아야 한다
+        for (int j = 0; j < function->params->count; j++){
+            if (((Element*)getElement(function->params, j))->data.token->name == name->name) function->param_slots = 0;
+        }
+    }
+    // 안쪽 함수가 인자를 붙잡을 수 있으면 인자는 환경에 있어야 한다
+    if (function->escapes) function->param_slots = 0;
+
+    // 본문은 인자와 같은 환경에서 실행되므로 같은 깊이에 선언한다
+    Compiler compiler = {NULL, NULL, 0, 0, 0, 1, 0, function->name->line};
+    for (int i = 0; i < function->params->count; i++){
+        declareLocal(&compiler, ((Element*)getElement(function->params, i))->data.token->name);
+    }
+    int param_count = function->param_slots ? function->params->count : 0;
+    for (int i = 0; i < function->body->count; i++){
+        resolveVariablesStmt(&compiler, param_count, elementStmt(getElement(function->body, i)));
+    }
+    heapFree(compiler.locals);
+}
+
+void resolveVariables(Array* statements){
+    Compiler compiler = {NULL, NULL, 0, 0, 0, 0, 0, 1};
+    for (int i = 0; i < statements->count; i++){
+        resolveVariablesStmt(&compiler, 0, elementStmt(getElement(statements, i)));
+    }
+    heapFree(compiler.locals);
+}
+
+void printCallStats(){
+    long calls = call_cache.hits + call_cache.misses;
+    double hit_rate = calls ? 100.0 * call_cache.hits / calls : 0.0;
+    fprintf(stderr, "[calls] %ld inline cache hits, %ld misses (%.1f%% hit rate)\n", call_cache.hits, call_cache.misses, hit_rate);
+    fprintf(stderr, "[calls] %ld call sites executed, %ld saw more than one callee\n", call_cache.sites, call_cache.polymorphic_sites);
+}
+
+void initStackGuard(char* base){
+    stack_base = (uintptr_t)base;
+    size_t limit = STACK_SIZE_FALLBACK;
+#if defined(__unix__) || defined(__APPLE__)
+    struct rlimit rlim;
+    if (getrlimit(RLIMIT_STACK, &rlim) == 0 && rlim.rlim_cur != RLIM_INFINITY) limit = (size_t)rlim.rlim_cur;
+#endif
+    // main 위에 이미 쌓인 몫(환경 변수, 인자)도 있으므로 여유는 넉넉히 남긴다
+    stack_budget = limit > 2 * STACK_GUARD_RESERVE ? limit - STACK_GUARD_RESERVE : limit / 2;
+}